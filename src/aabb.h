@@ -0,0 +1,30 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <algorithm>
+
+// Axis-aligned bounding box. Every block in the scene is one of these, so it
+// doubles as the exact geometry for batched slab tests.
+struct AABB {
+  glm::vec3 min;
+  glm::vec3 max;
+};
+
+// Whether origin + t * dir enters box for some t in [0, maxT]
+inline bool rayCrosses(const AABB& box, const glm::vec3& origin, const glm::vec3& dir, float maxT) {
+  float tNear = 0.0f;
+  float tFar = maxT;
+  for (int axis = 0; axis < 3; axis++) {
+    if (dir[axis] == 0.0f) {
+      if (origin[axis] < box.min[axis] || origin[axis] > box.max[axis]) return false;
+      continue;
+    }
+    float inv = 1.0f / dir[axis];
+    float t1 = (box.min[axis] - origin[axis]) * inv;
+    float t2 = (box.max[axis] - origin[axis]) * inv;
+    tNear = std::max(tNear, std::min(t1, t2));
+    tFar = std::min(tFar, std::max(t1, t2));
+    if (tNear > tFar) return false;
+  }
+  return true;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cmath>
+#include "cube.h"
+
+// Moves a cube along base + sineAxis * sin(phase) + cosineAxis * (cos(phase) - 1),
+// with phase advancing once per period. A zero cosineAxis gives a straight back
+// and forth motion, two perpendicular axes give a circle through the base
+// position.
+struct Animation {
+  int object;  // index of cube in the scene's object list
+  Cube* cube;
+  glm::vec3 baseMin;
+  glm::vec3 baseMax;
+  glm::vec3 sineAxis;
+  glm::vec3 cosineAxis;
+  float period;
+  float phase;
+
+  Animation(int object, Cube* cube, const glm::vec3& sineAxis, const glm::vec3& cosineAxis, float period, float phase = 0.0f)
+    : object(object), cube(cube), baseMin(cube->minBound), baseMax(cube->maxBound),
+      sineAxis(sineAxis), cosineAxis(cosineAxis), period(period), phase(phase) {}
+
+  void apply(float time) const {
+    float angle = 2.0f * 3.1415926f * time / period + phase;
+    glm::vec3 offset = sineAxis * std::sin(angle) + cosineAxis * (std::cos(angle) - 1.0f);
+    cube->minBound = baseMin + offset;
+    cube->maxBound = baseMax + offset;
+  }
+};
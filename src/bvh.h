@@ -0,0 +1,386 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <climits>
+#include <vector>
+#include "aabb.h"
+
+struct BVHNode {
+  AABB bounds;
+  int left = -1;            // -1 for leaves
+  int right = -1;
+  int parent = -1;
+  int primitive = -1;       // object index held by a leaf
+  int minPrimitive = 0;     // lowest object index in the subtree
+};
+
+// Bounding volume hierarchy over the objects' boxes, one object per leaf.
+// Moving, adding or removing an object only touches the nodes on its path to
+// the root; the tree is rebuilt from scratch once its SAH cost has drifted too
+// far from what a fresh build achieved.
+class BVH {
+public:
+  float rebuildThreshold = 1.25f;
+
+  void build(const std::vector<AABB>& bounds) {
+    nodes.clear();
+    freeNodes.clear();
+    root = -1;
+    leafOf.assign(bounds.size(), -1);
+    totalArea = 0.0;
+    unbalanced = false;
+
+    std::vector<int> order(bounds.size());
+    for (size_t i = 0; i < bounds.size(); i++) {
+      order[i] = static_cast<int>(i);
+    }
+    if (!bounds.empty()) {
+      root = split(order, 0, static_cast<int>(order.size()), 0, bounds);
+    }
+    builtCost = sahCost();
+    rebuilds++;
+  }
+
+  // Moves one object's box and fixes its ancestors
+  void refit(int primitive, const AABB& box) {
+    int leaf = leafOf[primitive];
+    setBounds(leaf, box);
+    fixUpwards(nodes[leaf].parent);
+  }
+
+  // Adds an object whose index is the current object count, next to the
+  // subtree that grows the least by taking it in
+  void insert(int primitive, const AABB& box) {
+    if (primitive >= static_cast<int>(leafOf.size())) {
+      leafOf.resize(primitive + 1, -1);
+    }
+    int leaf = allocate();
+    nodes[leaf].primitive = primitive;
+    nodes[leaf].minPrimitive = primitive;
+    setBounds(leaf, box);
+    leafOf[primitive] = leaf;
+
+    if (root < 0) {
+      root = leaf;
+      return;
+    }
+
+    int sibling = root;
+    int depth = 1;
+    while (nodes[sibling].left >= 0) {
+      const AABB& l = nodes[nodes[sibling].left].bounds;
+      const AABB& r = nodes[nodes[sibling].right].bounds;
+      float growLeft = area(merge(l, box)) - area(l);
+      float growRight = area(merge(r, box)) - area(r);
+      sibling = growLeft <= growRight ? nodes[sibling].left : nodes[sibling].right;
+      depth++;
+    }
+
+    int oldParent = nodes[sibling].parent;
+    int parent = allocate();
+    nodes[parent].parent = oldParent;
+    nodes[parent].left = sibling;
+    nodes[parent].right = leaf;
+    nodes[sibling].parent = parent;
+    nodes[leaf].parent = parent;
+    replaceChild(oldParent, sibling, parent);
+    fixUpwards(parent);
+
+    if (depth >= MAX_DEPTH) {
+      unbalanced = true;
+    }
+  }
+
+  // Removes an object the way the caller removes it from the object list:
+  // the last object takes over the removed index
+  void remove(int primitive) {
+    int leaf = leafOf[primitive];
+    int parent = nodes[leaf].parent;
+    release(leaf);
+
+    if (parent < 0) {
+      root = -1;
+    } else {
+      int sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+      int grandParent = nodes[parent].parent;
+      nodes[sibling].parent = grandParent;
+      replaceChild(grandParent, parent, sibling);
+      release(parent);
+      fixUpwards(grandParent);
+    }
+
+    int last = static_cast<int>(leafOf.size()) - 1;
+    if (primitive != last) {
+      int moved = leafOf[last];
+      leafOf[primitive] = moved;
+      nodes[moved].primitive = primitive;
+      nodes[moved].minPrimitive = primitive;
+      fixUpwards(nodes[moved].parent);
+    }
+    leafOf.pop_back();
+  }
+
+  // Rebuilds when edits and motion left the tree much worse than a fresh
+  // build would be. Returns true if it did.
+  bool maintain() {
+    if (root < 0 || (!unbalanced && sahCost() <= builtCost * rebuildThreshold)) {
+      return false;
+    }
+    std::vector<AABB> bounds(leafOf.size());
+    for (size_t i = 0; i < leafOf.size(); i++) {
+      bounds[i] = nodes[leafOf[i]].bounds;
+    }
+    build(bounds);
+    return true;
+  }
+
+  // Closest primitive along the ray. distance(primitive) returns the hit
+  // distance or a negative value on a miss; ties go to the lowest index, the
+  // same result as testing every primitive in order.
+  template <typename Distance>
+  int closest(const glm::vec3& origin, const glm::vec3& dir, float maxDist, const Distance& distance) const {
+    if (root < 0) return -1;
+    glm::vec3 inv = 1.0f / dir;
+
+    int best = -1;
+    float bestDist = maxDist;
+    int stack[STACK_SIZE];
+    int top = 0;
+    stack[top++] = root;
+
+    while (top > 0) {
+      const BVHNode& node = nodes[stack[--top]];
+      float entry;
+      if (!enters(node.bounds, origin, inv, entry) || entry > bestDist) continue;
+
+      if (node.left < 0) {
+        float d = distance(node.primitive);
+        if (d >= 0.0f && (d < bestDist || (d == bestDist && best >= 0 && node.primitive < best))) {
+          bestDist = d;
+          best = node.primitive;
+        }
+        continue;
+      }
+
+      // Push the farther child first so the nearer one is popped next
+      float leftEntry, rightEntry;
+      bool hitLeft = enters(nodes[node.left].bounds, origin, inv, leftEntry);
+      bool hitRight = enters(nodes[node.right].bounds, origin, inv, rightEntry);
+      if (hitLeft && hitRight) {
+        bool leftFirst = leftEntry <= rightEntry;
+        stack[top++] = leftFirst ? node.right : node.left;
+        stack[top++] = leftFirst ? node.left : node.right;
+      } else if (hitLeft) {
+        stack[top++] = node.left;
+      } else if (hitRight) {
+        stack[top++] = node.right;
+      }
+    }
+    return best;
+  }
+
+  // Lowest-index primitive for which hits(primitive) is true, -1 for none.
+  // Subtrees that only hold higher indices than the current answer are skipped.
+  template <typename Hits>
+  int first(const glm::vec3& origin, const glm::vec3& dir, const Hits& hits) const {
+    if (root < 0) return -1;
+    glm::vec3 inv = 1.0f / dir;
+
+    int best = INT_MAX;
+    int stack[STACK_SIZE];
+    int top = 0;
+    stack[top++] = root;
+
+    while (top > 0) {
+      const BVHNode& node = nodes[stack[--top]];
+      float entry;
+      if (node.minPrimitive >= best || !enters(node.bounds, origin, inv, entry)) continue;
+
+      if (node.left < 0) {
+        if (hits(node.primitive)) {
+          best = node.primitive;
+        }
+        continue;
+      }
+
+      bool leftFirst = nodes[node.left].minPrimitive <= nodes[node.right].minPrimitive;
+      stack[top++] = leftFirst ? node.right : node.left;
+      stack[top++] = leftFirst ? node.left : node.right;
+    }
+    return best == INT_MAX ? -1 : best;
+  }
+
+  int getRebuilds() const {
+    return rebuilds;
+  }
+
+private:
+  static const int SAH_BINS = 12;
+  static const int MAX_SAH_DEPTH = 40;  // median splits below this keep the tree shallow
+  static const int MAX_DEPTH = 56;      // deeper inserts force a rebuild
+  static const int STACK_SIZE = 64;
+
+  std::vector<BVHNode> nodes;
+  std::vector<int> freeNodes;
+  std::vector<int> leafOf;              // leaf node of each object
+  int root = -1;
+  double totalArea = 0.0;               // surface area summed over every live node
+  float builtCost = 0.0f;
+  bool unbalanced = false;
+  int rebuilds = 0;
+
+  static AABB merge(const AABB& a, const AABB& b) {
+    return AABB{glm::min(a.min, b.min), glm::max(a.max, b.max)};
+  }
+
+  static float area(const AABB& box) {
+    glm::vec3 e = box.max - box.min;
+    return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+  }
+
+  // Same slab test as Cube::rayIntersect, so a node is entered whenever one
+  // of its objects would report a hit
+  static bool enters(const AABB& box, const glm::vec3& origin, const glm::vec3& inv, float& entry) {
+    glm::vec3 t1 = (box.min - origin) * inv;
+    glm::vec3 t2 = (box.max - origin) * inv;
+    glm::vec3 tmin = glm::min(t1, t2);
+    glm::vec3 tmax = glm::max(t1, t2);
+    float tNear = glm::max(glm::max(tmin.x, tmin.y), tmin.z);
+    float tFar = glm::min(glm::min(tmax.x, tmax.y), tmax.z);
+    entry = tNear;
+    return !(tNear > tFar || tFar < 0);
+  }
+
+  // Expected cost of a random ray relative to the root's surface area. Every
+  // node counts once, leaves hold exactly one object.
+  float sahCost() const {
+    if (root < 0) return 0.0f;
+    return static_cast<float>(totalArea / std::max(area(nodes[root].bounds), 1e-6f));
+  }
+
+  int allocate() {
+    int index;
+    if (!freeNodes.empty()) {
+      index = freeNodes.back();
+      freeNodes.pop_back();
+      nodes[index] = BVHNode();
+    } else {
+      index = static_cast<int>(nodes.size());
+      nodes.emplace_back();
+    }
+    nodes[index].bounds = AABB{glm::vec3(0.0f), glm::vec3(0.0f)};
+    return index;
+  }
+
+  void release(int index) {
+    totalArea -= area(nodes[index].bounds);
+    freeNodes.push_back(index);
+  }
+
+  void setBounds(int index, const AABB& box) {
+    totalArea += area(box) - area(nodes[index].bounds);
+    nodes[index].bounds = box;
+  }
+
+  void replaceChild(int parent, int oldChild, int newChild) {
+    if (parent < 0) {
+      root = newChild;
+    } else if (nodes[parent].left == oldChild) {
+      nodes[parent].left = newChild;
+    } else {
+      nodes[parent].right = newChild;
+    }
+  }
+
+  // Recomputes bounds and lowest index from the children up to the root
+  void fixUpwards(int index) {
+    while (index >= 0) {
+      BVHNode& node = nodes[index];
+      setBounds(index, merge(nodes[node.left].bounds, nodes[node.right].bounds));
+      node.minPrimitive = std::min(nodes[node.left].minPrimitive, nodes[node.right].minPrimitive);
+      index = node.parent;
+    }
+  }
+
+  // Top-down binned SAH build over order[begin, end), returns the subtree root
+  int split(std::vector<int>& order, int begin, int end, int depth, const std::vector<AABB>& bounds) {
+    int index = allocate();
+    if (end - begin == 1) {
+      int primitive = order[begin];
+      nodes[index].primitive = primitive;
+      nodes[index].minPrimitive = primitive;
+      setBounds(index, bounds[primitive]);
+      leafOf[primitive] = index;
+      return index;
+    }
+
+    auto centroid = [&](int primitive) { return (bounds[primitive].min + bounds[primitive].max) * 0.5f; };
+    AABB centroidBox{centroid(order[begin]), centroid(order[begin])};
+    for (int i = begin + 1; i < end; i++) {
+      centroidBox = merge(centroidBox, AABB{centroid(order[i]), centroid(order[i])});
+    }
+
+    // Binned SAH over the widest centroid axis
+    glm::vec3 extent = centroidBox.max - centroidBox.min;
+    int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+    int mid = begin;
+
+    if (extent[axis] > 0.0f && depth < MAX_SAH_DEPTH) {
+      AABB binBounds[SAH_BINS];
+      int binCount[SAH_BINS] = {};
+      auto binOf = [&](int primitive) {
+        int b = static_cast<int>((centroid(primitive)[axis] - centroidBox.min[axis]) / extent[axis] * SAH_BINS);
+        return std::min(b, SAH_BINS - 1);
+      };
+      for (int i = begin; i < end; i++) {
+        int b = binOf(order[i]);
+        binBounds[b] = binCount[b]++ == 0 ? bounds[order[i]] : merge(binBounds[b], bounds[order[i]]);
+      }
+
+      float bestCost = 1e30f;
+      int bestSplit = -1;
+      for (int s = 1; s < SAH_BINS; s++) {
+        AABB leftBox{}, rightBox{};
+        int leftCount = 0, rightCount = 0;
+        for (int b = 0; b < SAH_BINS; b++) {
+          if (binCount[b] == 0) continue;
+          if (b < s) {
+            leftBox = leftCount == 0 ? binBounds[b] : merge(leftBox, binBounds[b]);
+            leftCount += binCount[b];
+          } else {
+            rightBox = rightCount == 0 ? binBounds[b] : merge(rightBox, binBounds[b]);
+            rightCount += binCount[b];
+          }
+        }
+        if (leftCount == 0 || rightCount == 0) continue;
+        float cost = area(leftBox) * leftCount + area(rightBox) * rightCount;
+        if (cost < bestCost) {
+          bestCost = cost;
+          bestSplit = s;
+        }
+      }
+
+      if (bestSplit > 0) {
+        auto pivot = std::partition(order.begin() + begin, order.begin() + end,
+                                    [&](int primitive) { return binOf(primitive) < bestSplit; });
+        mid = static_cast<int>(pivot - order.begin());
+      }
+    }
+
+    if (mid == begin || mid == end) {
+      mid = begin + (end - begin) / 2;
+      std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                       [&](int a, int b) { return centroid(a)[axis] < centroid(b)[axis]; });
+    }
+
+    int left = split(order, begin, mid, depth + 1, bounds);
+    int right = split(order, mid, end, depth + 1, bounds);
+    nodes[index].left = left;
+    nodes[index].right = right;
+    nodes[left].parent = index;
+    nodes[right].parent = index;
+    setBounds(index, merge(nodes[left].bounds, nodes[right].bounds));
+    nodes[index].minPrimitive = std::min(nodes[left].minPrimitive, nodes[right].minPrimitive);
+    return index;
+  }
+};
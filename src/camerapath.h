@@ -0,0 +1,96 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "camera.h"
+
+struct CameraKey {
+  float time;
+  glm::vec3 position;
+  glm::vec3 target;
+  glm::vec3 up;
+};
+
+// Keyframed camera flythrough. A path file holds one key per line,
+//   time  px py pz  tx ty tz  ux uy uz
+// with times in seconds and increasing; blank lines and lines starting with
+// # are skipped. Position and target follow a Catmull-Rom spline through the
+// keys, the up vector is blended linearly.
+class CameraPath {
+public:
+  static CameraPath load(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+      throw std::runtime_error("Unable to open camera path " + path);
+    }
+
+    CameraPath result;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+      lineNumber++;
+      size_t start = line.find_first_not_of(" \t\r");
+      if (start == std::string::npos || line[start] == '#') continue;
+
+      std::istringstream fields(line);
+      CameraKey key;
+      if (!(fields >> key.time >> key.position.x >> key.position.y >> key.position.z
+                   >> key.target.x >> key.target.y >> key.target.z
+                   >> key.up.x >> key.up.y >> key.up.z)) {
+        throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": expected 10 numbers");
+      }
+      if (!result.keys.empty() && key.time <= result.keys.back().time) {
+        throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": key times must increase");
+      }
+      result.keys.push_back(key);
+    }
+
+    if (result.keys.empty()) {
+      throw std::runtime_error("Camera path " + path + " has no keys");
+    }
+    return result;
+  }
+
+  float duration() const {
+    return keys.back().time - keys.front().time;
+  }
+
+  Camera at(float time, float rotationSpeed) const {
+    time = std::clamp(time + keys.front().time, keys.front().time, keys.back().time);
+    if (keys.size() == 1) {
+      return Camera(keys[0].position, keys[0].target, keys[0].up, rotationSpeed);
+    }
+
+    size_t i = 0;
+    while (i + 2 < keys.size() && time > keys[i + 1].time) {
+      i++;
+    }
+    const CameraKey& k0 = keys[i > 0 ? i - 1 : i];
+    const CameraKey& k1 = keys[i];
+    const CameraKey& k2 = keys[i + 1];
+    const CameraKey& k3 = keys[std::min(i + 2, keys.size() - 1)];
+    float t = (time - k1.time) / (k2.time - k1.time);
+
+    glm::vec3 up = glm::normalize(k1.up + (k2.up - k1.up) * t);
+    return Camera(
+      catmullRom(k0.position, k1.position, k2.position, k3.position, t),
+      catmullRom(k0.target, k1.target, k2.target, k3.target, t),
+      up,
+      rotationSpeed
+    );
+  }
+
+private:
+  std::vector<CameraKey> keys;
+
+  static glm::vec3 catmullRom(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3, float t) {
+    float t2 = t * t;
+    float t3 = t2 * t;
+    return 0.5f * ((2.0f * p1) + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 +
+                   (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+  }
+};
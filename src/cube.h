@@ -4,6 +4,7 @@
 #include "object.h"
 #include <string>
 #include "imageloader.h"
+#include "shadinglod.h"
 
 
 class Cube : public Object {
@@ -11,7 +12,7 @@ public:
   Cube(const glm::vec3& minBound, const glm::vec3& maxBound, const Material& mat)
     : minBound(glm::min(minBound, maxBound)), maxBound(glm::max(minBound, maxBound)), Object(mat) {}
 
-  Intersect rayIntersect(const glm::vec3& rayOrigin, const glm::vec3& rayDirection) const override {
+  Intersect rayIntersect(const glm::vec3& rayOrigin, const glm::vec3& rayDirection, float pathDistance) const override {
 
     glm::vec3 invRayDir = 1.0f / rayDirection;
 
@@ -44,7 +45,19 @@ public:
     return Intersect{true, dist, point, glm::normalize(normal), false};
   };
 
-  Color loadTexture(float x, float y, const std::string texturekey) const{
+  AABB getBounds() const override {
+    return AABB{minBound, maxBound};
+  };
+
+  // dist is how far from the camera, along the whole ray path, the texel was
+  // hit; far away the fetch is replaced by the texture's average colour, see
+  // ShadingLOD
+  Color loadTexture(float x, float y, const std::string texturekey, float dist) const{
+
+    float detail = shadingLOD.textureDetail(dist);
+    if (detail <= 0.0f) {
+      return ImageLoader::getAverageColor(texturekey);
+    }
 
     glm::vec2 tsize = ImageLoader::getImageSize(texturekey);
 
@@ -53,7 +66,7 @@ public:
 
     Color c = ImageLoader::getPixelColor(texturekey, tx, ty);
 
-    return c;
+    return fadeDetail(c, ImageLoader::getAverageColor(texturekey), detail);
 
   };
 
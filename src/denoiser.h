@@ -0,0 +1,114 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "parallel.h"
+
+// Surface attributes of each pixel's primary hit, written next to the noisy
+// colour so the filter knows where the edges are.
+struct GBuffer {
+  int width = 0;
+  int height = 0;
+  std::vector<float> normalX, normalY, normalZ;
+  std::vector<float> depth;
+  std::vector<float> albedoR, albedoG, albedoB;
+  std::vector<int> objectId;  // -1 where the primary ray reached the skybox
+
+  void resize(int w, int h) {
+    width = w;
+    height = h;
+    size_t count = static_cast<size_t>(w) * h;
+    normalX.resize(count); normalY.resize(count); normalZ.resize(count);
+    depth.resize(count);
+    albedoR.resize(count); albedoG.resize(count); albedoB.resize(count);
+    objectId.resize(count);
+  }
+};
+
+// Edge-aware A-Trous wavelet filter. Works on albedo-demodulated irradiance
+// planes and stops at object, depth, normal and luminance discontinuities, so
+// block edges and textures survive while sampling noise is smoothed out.
+class Denoiser {
+public:
+  int iterations = 4;
+  float sigmaDepth = 0.02f;     // relative to the centre pixel's depth, per unit of step
+  float normalPower = 64.0f;
+  float sigmaLuminance = 0.5f;
+
+  void filter(const GBuffer& gbuffer, std::vector<float>& r, std::vector<float>& g, std::vector<float>& b) {
+    tempR.resize(r.size());
+    tempG.resize(g.size());
+    tempB.resize(b.size());
+
+    for (int iteration = 0; iteration < iterations; iteration++) {
+      int step = 1 << iteration;
+      parallelFor(0, gbuffer.height, [&](int y) {
+        filterRow(gbuffer, r.data(), g.data(), b.data(), tempR.data(), tempG.data(), tempB.data(), y, step);
+      });
+      r.swap(tempR);
+      g.swap(tempG);
+      b.swap(tempB);
+    }
+  }
+
+private:
+  std::vector<float> tempR, tempG, tempB;
+
+  static float luminance(float r, float g, float b) {
+    return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+  }
+
+  void filterRow(const GBuffer& gb, const float* inR, const float* inG, const float* inB,
+                 float* outR, float* outG, float* outB, int y, int step) const {
+    static const float kernel[5] = {1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+    const int width = gb.width;
+    const int height = gb.height;
+
+    for (int x = 0; x < width; x++) {
+      int p = y * width + x;
+      int id = gb.objectId[p];
+      if (id < 0) {
+        outR[p] = inR[p];
+        outG[p] = inG[p];
+        outB[p] = inB[p];
+        continue;
+      }
+
+      float lumP = luminance(inR[p], inG[p], inB[p]);
+      float depthScale = 1.0f / (sigmaDepth * gb.depth[p] * step + 1e-4f);
+      float sumW = 0.0f, sumR = 0.0f, sumG = 0.0f, sumB = 0.0f;
+
+      for (int j = -2; j <= 2; j++) {
+        int qy = y + j * step;
+        if (qy < 0 || qy >= height) continue;
+
+        for (int i = -2; i <= 2; i++) {
+          int qx = x + i * step;
+          if (qx < 0 || qx >= width) continue;
+
+          int q = qy * width + qx;
+          if (gb.objectId[q] != id) continue;
+
+          float nDot = gb.normalX[p] * gb.normalX[q] + gb.normalY[p] * gb.normalY[q] + gb.normalZ[p] * gb.normalZ[q];
+          if (nDot <= 0.0f) continue;
+
+          float wNormal = std::pow(nDot, normalPower);
+          float wDepth = std::exp(-std::abs(gb.depth[p] - gb.depth[q]) * depthScale);
+          float wLum = std::exp(-std::abs(lumP - luminance(inR[q], inG[q], inB[q])) / sigmaLuminance);
+          float w = kernel[i + 2] * kernel[j + 2] * wNormal * wDepth * wLum;
+
+          sumW += w;
+          sumR += w * inR[q];
+          sumG += w * inG[q];
+          sumB += w * inB[q];
+        }
+      }
+
+      // The centre tap always contributes, so sumW is never zero
+      outR[p] = sumR / sumW;
+      outG[p] = sumG / sumW;
+      outB[p] = sumB / sumW;
+    }
+  }
+};
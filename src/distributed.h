@@ -0,0 +1,234 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <SDL2/SDL.h>
+#include "color.h"
+#include "net.h"
+
+// Wire format. Both ends are this same binary, so structs go over the socket
+// as raw bytes in host byte order.
+const uint32_t TILE_PROTOCOL_MAGIC = 0x4D435254;  // "MCRT"
+const uint32_t SHUTDOWN_FRAME = 0xFFFFFFFF;
+
+struct TileJob {
+  uint32_t frame;
+  int32_t x, y, w, h;           // tile rectangle inside the frame
+  int32_t width, height;        // full frame size
+  float position[3];
+  float target[3];
+  float up[3];
+};
+
+struct TileResult {
+  uint32_t frame;
+  int32_t x, y, w, h;           // followed by w * h Colors
+};
+
+using TileRenderer = std::function<void(const TileJob&, std::vector<Color>&)>;
+
+// Worker process side: render whatever tiles the coordinator sends until it
+// says to stop or the connection drops.
+inline int runTileWorker(const std::string& host, uint16_t port, const TileRenderer& renderTile) {
+  Socket socket = Socket::connectTo(host, port);
+  if (!socket.isValid()) {
+    SDL_Log("Worker could not connect to %s:%d", host.c_str(), port);
+    return 1;
+  }
+
+  uint32_t magic = TILE_PROTOCOL_MAGIC;
+  if (!socket.sendAll(&magic, sizeof(magic))) return 1;
+
+  std::vector<Color> pixels;
+  TileJob job;
+  while (socket.recvAll(&job, sizeof(job)) && job.frame != SHUTDOWN_FRAME) {
+    pixels.resize(static_cast<size_t>(job.w) * job.h);
+    renderTile(job, pixels);
+
+    TileResult result = {job.frame, job.x, job.y, job.w, job.h};
+    if (!socket.sendAll(&result, sizeof(result)) ||
+        !socket.sendAll(pixels.data(), pixels.size() * sizeof(Color))) {
+      break;
+    }
+  }
+  return 0;
+}
+
+// Coordinator side: accepts workers at any time, hands tiles out on demand
+// (so faster workers take more of them) and puts the tiles of a worker that
+// fails or stalls back on the queue for someone else.
+class RenderCoordinator {
+public:
+  RenderCoordinator(uint16_t port, int tileSize, int workerTimeoutMs = 120000)
+    : tileSize(tileSize), workerTimeoutMs(workerTimeoutMs) {
+    listener = Socket::listenOn(port);
+    if (listener.isValid()) {
+      acceptThread = std::thread([this]() { acceptLoop(); });
+    }
+  }
+
+  ~RenderCoordinator() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    changed.notify_all();
+    if (acceptThread.joinable()) acceptThread.join();
+    for (auto& worker : workerThreads) {
+      worker.join();
+    }
+  }
+
+  bool isListening() const {
+    return listener.isValid();
+  }
+
+  // Splits every view into tiles and blocks until all of them came back.
+  // frames[i] receives the width * height pixels of views[i].
+  void render(const std::vector<TileJob>& views, std::vector<std::vector<Color>>& frames) {
+    std::unique_lock<std::mutex> lock(mutex);
+    output = &frames;
+    frames.resize(views.size());
+
+    for (size_t f = 0; f < views.size(); f++) {
+      const TileJob& view = views[f];
+      frames[f].assign(static_cast<size_t>(view.width) * view.height, Color());
+      for (int y = 0; y < view.height; y += tileSize) {
+        for (int x = 0; x < view.width; x += tileSize) {
+          TileJob job = view;
+          job.frame = static_cast<uint32_t>(f);
+          job.x = x;
+          job.y = y;
+          job.w = std::min(tileSize, view.width - x);
+          job.h = std::min(tileSize, view.height - y);
+          pending.push_back(job);
+          remaining++;
+        }
+      }
+    }
+    changed.notify_all();
+
+    while (remaining > 0) {
+      if (!changed.wait_for(lock, std::chrono::seconds(5), [this]() { return remaining == 0; })) {
+        SDL_Log("Waiting on %d tiles, %d workers connected", remaining, liveWorkers);
+      }
+    }
+    output = nullptr;
+  }
+
+private:
+  const int maxInFlight = 2;  // keeps a worker busy while its last tile is on the wire
+
+  int tileSize;
+  int workerTimeoutMs;
+  Socket listener;
+  std::thread acceptThread;
+  std::vector<std::thread> workerThreads;
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<TileJob> pending;
+  std::vector<std::vector<Color>>* output = nullptr;
+  int remaining = 0;
+  int liveWorkers = 0;
+  bool stopping = false;
+
+  void acceptLoop() {
+    while (true) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping) return;
+      }
+      if (!listener.waitReadable(200)) continue;
+
+      Socket client = listener.accept();
+      if (!client.isValid()) continue;
+      client.setReceiveTimeout(workerTimeoutMs);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      workerThreads.emplace_back([this, socket = std::move(client)]() mutable {
+        serveWorker(std::move(socket));
+      });
+    }
+  }
+
+  void requeue(std::deque<TileJob>& inFlight) {
+    std::lock_guard<std::mutex> lock(mutex);
+    while (!inFlight.empty()) {
+      pending.push_front(inFlight.back());
+      inFlight.pop_back();
+    }
+    liveWorkers--;
+    changed.notify_all();
+  }
+
+  void serveWorker(Socket socket) {
+    uint32_t magic = 0;
+    if (!socket.recvAll(&magic, sizeof(magic)) || magic != TILE_PROTOCOL_MAGIC) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      liveWorkers++;
+    }
+    SDL_Log("Worker connected");
+
+    std::deque<TileJob> inFlight;
+    std::vector<Color> pixels;
+    while (true) {
+      std::vector<TileJob> toSend;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&]() { return stopping || !pending.empty() || !inFlight.empty(); });
+        if (stopping && inFlight.empty()) break;
+        while (static_cast<int>(inFlight.size()) < maxInFlight && !pending.empty()) {
+          inFlight.push_back(pending.front());
+          toSend.push_back(pending.front());
+          pending.pop_front();
+        }
+      }
+
+      bool sent = true;
+      for (const TileJob& job : toSend) {
+        sent = sent && socket.sendAll(&job, sizeof(job));
+      }
+
+      TileResult result;
+      const TileJob& expected = inFlight.front();
+      pixels.resize(static_cast<size_t>(expected.w) * expected.h);
+      bool received = sent &&
+        socket.recvAll(&result, sizeof(result)) &&
+        result.frame == expected.frame && result.x == expected.x && result.y == expected.y &&
+        result.w == expected.w && result.h == expected.h &&
+        socket.recvAll(pixels.data(), pixels.size() * sizeof(Color));
+      if (!received) {
+        SDL_Log("Worker failed, resubmitting %d tiles", static_cast<int>(inFlight.size()));
+        requeue(inFlight);
+        return;
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      std::vector<Color>& frame = (*output)[result.frame];
+      for (int row = 0; row < result.h; row++) {
+        std::copy(pixels.begin() + row * result.w, pixels.begin() + (row + 1) * result.w,
+                  frame.begin() + static_cast<size_t>(result.y + row) * expected.width + result.x);
+      }
+      inFlight.pop_front();
+      remaining--;
+      changed.notify_all();
+    }
+
+    TileJob shutdown = {};
+    shutdown.frame = SHUTDOWN_FRAME;
+    socket.sendAll(&shutdown, sizeof(shutdown));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    liveWorkers--;
+  }
+};
@@ -3,44 +3,51 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 #include <stdexcept>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <map>
+#include <memory>
 #include <string>
+#include <vector>
 #include "color.h"
+#include "texture.h"
+#include "mappedfile.h"
+#include "threadpool.h"
 #include <glm/glm.hpp>
 
 
 class ImageLoader {
 private:
-    static std::map<std::string, SDL_Surface*> imageSurfaces;
-    static std::map<std::string, glm::vec2> imageSize;
-    
-public:
-    // Initialize SDL_image
-    static void init() {
-        int imgFlags = IMG_INIT_JPG | IMG_INIT_PNG; 
-        if (!(IMG_Init(imgFlags) & imgFlags)) {
-            throw std::runtime_error("SDL_image could not initialize! SDL_image Error: " + std::string(IMG_GetError()));
-        }
-    }
+    // A registered image. Readers see the placeholder colour until a loader
+    // thread publishes the decoded texels through ready.
+    struct ImageEntry {
+        std::atomic<bool> ready{false};
+        SDL_Surface* surface = nullptr;
+        CompressedTexture compressed;
+        Color placeholder;
+        Color average;    // mean of all texels, stands in for them on distant hits
+    };
 
-    // Load an image from a given path and store with a key
-    static void loadImage(const std::string& key, const char* path, float xSize, float ySize) {
-        SDL_Surface* newSurface = IMG_Load(path);
-        if (!newSurface) {
-            throw std::runtime_error("Unable to load image! SDL_image Error: " + std::string(IMG_GetError()));
-        }
-        imageSurfaces[key] = newSurface;
-        ImageLoader::imageSize[key] = glm::vec2(xSize, ySize);
-    }
+    // Header of a pre-decoded texture in the disk cache, followed by the texel payload
+    struct CacheHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t format;
+        int32_t width;
+        int32_t height;
+        uint32_t reserved;
+        uint64_t sourceSize;
+        int64_t sourceTime;
+    };
 
-    // Get the color of the pixel at (x, y) from an image with a specific key
-    static Color getPixelColor(const std::string& key, int x, int y) {
-        auto it = imageSurfaces.find(key);
-        if (it == imageSurfaces.end()) {
-            throw std::runtime_error("Image key not found!");
-        }
+    static std::map<std::string, std::unique_ptr<ImageEntry>> images;
+    static std::map<std::string, glm::vec2> imageSize;
+    static std::atomic<int> readyImages;
 
-        SDL_Surface* targetSurface = it->second;
+    static Color readSurfacePixel(SDL_Surface* targetSurface, int x, int y) {
         int bpp = targetSurface->format->BytesPerPixel;
         Uint8 *p = (Uint8 *)targetSurface->pixels + y * targetSurface->pitch + x * bpp;
 
@@ -71,13 +78,199 @@ public:
         return Color{color.r, color.g, color.b};
     }
 
+    // Must run before any thread starts sampling, the map is not locked
+    static ImageEntry& registerImage(const std::string& key, float xSize, float ySize, const Color& placeholder) {
+        auto& entry = images[key];
+        entry = std::make_unique<ImageEntry>();
+        entry->placeholder = placeholder;
+        ImageLoader::imageSize[key] = glm::vec2(xSize, ySize);
+        return *entry;
+    }
+
+    static void sourceStamp(const std::string& path, uint64_t& size, int64_t& time) {
+        size = std::filesystem::file_size(path);
+        time = static_cast<int64_t>(std::filesystem::last_write_time(path).time_since_epoch().count());
+    }
+
+    static bool loadCached(ImageEntry& entry, const std::string& cachePath, const std::string& path, TextureFormat format) {
+        auto file = std::make_shared<MappedFile>(cachePath);
+        if (!file->isOpen() || file->size() < sizeof(CacheHeader)) {
+            return false;
+        }
+
+        CacheHeader header;
+        std::memcpy(&header, file->data(), sizeof(header));
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        sourceStamp(path, sourceSize, sourceTime);
+        if (std::memcmp(header.magic, "MCTX", 4) != 0 || header.version != 1 ||
+            header.format != static_cast<uint32_t>(format) ||
+            header.sourceSize != sourceSize || header.sourceTime != sourceTime ||
+            header.width < 1 || header.height < 1 ||
+            sizeof(header) + CompressedTexture::payloadSize(format, header.width, header.height) > file->size()) {
+            return false;
+        }
+
+        entry.compressed = CompressedTexture::fromMapping(file, sizeof(header), format, header.width, header.height);
+        return true;
+    }
+
+    // Written to a temporary name first so a crash never leaves a torn cache file
+    static void writeCache(const std::string& cachePath, const std::string& path, const CompressedTexture& texture) {
+        CacheHeader header = {};
+        std::memcpy(header.magic, "MCTX", 4);
+        header.version = 1;
+        header.format = static_cast<uint32_t>(texture.format);
+        header.width = texture.width;
+        header.height = texture.height;
+        sourceStamp(path, header.sourceSize, header.sourceTime);
+
+        std::string tempPath = temporaryPath(cachePath);
+        bool written;
+        {
+            std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char*>(texture.data()), texture.byteSize());
+            written = static_cast<bool>(out);
+        }
+        std::error_code error;
+        if (written) {
+            std::filesystem::rename(tempPath, cachePath, error);
+        }
+        if (!written || error) {
+            std::filesystem::remove(tempPath, error);
+        }
+    }
+
+    static Color averageColor(const ImageEntry& entry) {
+        int width = entry.surface ? entry.surface->w : entry.compressed.width;
+        int height = entry.surface ? entry.surface->h : entry.compressed.height;
+        uint64_t r = 0, g = 0, b = 0;
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                Color c = entry.surface ? readSurfacePixel(entry.surface, x, y) : entry.compressed.fetch(x, y);
+                r += c.r;
+                g += c.g;
+                b += c.b;
+            }
+        }
+        uint64_t count = std::max<uint64_t>(static_cast<uint64_t>(width) * height, 1);
+        return Color(static_cast<int>(r / count), static_cast<int>(g / count), static_cast<int>(b / count));
+    }
+
+    static void decodeImage(ImageEntry& entry, const std::string& key, const std::string& path, TextureFormat format, const std::string& cacheDir) {
+        // Surface textures are cached as packed RGB so they can be mapped back in
+        TextureFormat packed = format == TextureFormat::Surface ? TextureFormat::RGB888 : format;
+        std::string cachePath = cacheDir.empty() ? "" : cacheDir + "/" + key + ".tex";
+
+        if (cachePath.empty() || !loadCached(entry, cachePath, path, packed)) {
+            SDL_Surface* newSurface = IMG_Load(path.c_str());
+            if (!newSurface) {
+                throw std::runtime_error("Unable to load image! SDL_image Error: " + std::string(IMG_GetError()));
+            }
+
+            if (cachePath.empty() && format == TextureFormat::Surface) {
+                entry.surface = newSurface;
+            } else {
+                std::vector<Color> pixels(static_cast<size_t>(newSurface->w) * newSurface->h);
+                for (int y = 0; y < newSurface->h; y++) {
+                    for (int x = 0; x < newSurface->w; x++) {
+                        pixels[y * newSurface->w + x] = readSurfacePixel(newSurface, x, y);
+                    }
+                }
+                entry.compressed = CompressedTexture::encode(pixels, newSurface->w, newSurface->h, packed);
+                SDL_FreeSurface(newSurface);
+
+                if (!cachePath.empty()) {
+                    writeCache(cachePath, path, entry.compressed);
+                }
+            }
+        }
+
+        entry.average = averageColor(entry);
+        entry.ready.store(true, std::memory_order_release);
+        readyImages.fetch_add(1, std::memory_order_release);
+    }
+    
+public:
+    // Initialize SDL_image
+    static void init() {
+        int imgFlags = IMG_INIT_JPG | IMG_INIT_PNG; 
+        if (!(IMG_Init(imgFlags) & imgFlags)) {
+            throw std::runtime_error("SDL_image could not initialize! SDL_image Error: " + std::string(IMG_GetError()));
+        }
+    }
+
+    // Load an image from a given path and store with a key. Compressed formats
+    // re-encode the decoded surface and free it.
+    static void loadImage(const std::string& key, const char* path, float xSize, float ySize, TextureFormat format = TextureFormat::Surface) {
+        ImageEntry& entry = registerImage(key, xSize, ySize, Color(0, 0, 0));
+        decodeImage(entry, key, path, format, "");
+    }
+
+    // Queue an image for decoding on the pool. Until it is ready, lookups return
+    // the placeholder colour. With a cache directory the decoded texels are
+    // stored there and memory-mapped straight back in on later runs.
+    static void loadImageAsync(ThreadPool& pool, const std::string& key, const char* path, float xSize, float ySize,
+                               TextureFormat format, const Color& placeholder, const std::string& cacheDir = "") {
+        ImageEntry& entry = registerImage(key, xSize, ySize, placeholder);
+        if (!cacheDir.empty()) {
+            std::error_code error;
+            std::filesystem::create_directories(cacheDir, error);
+        }
+
+        std::string source = path;
+        pool.submit([&entry, key, source, format, cacheDir]() {
+            try {
+                decodeImage(entry, key, source, format, cacheDir);
+            } catch (const std::exception& e) {
+                SDL_Log("Texture %s stays a placeholder: %s", key.c_str(), e.what());
+            }
+        });
+    }
+
+    // Get the color of the pixel at (x, y) from an image with a specific key
+    static Color getPixelColor(const std::string& key, int x, int y) {
+        auto it = images.find(key);
+        if (it == images.end()) {
+            throw std::runtime_error("Image key not found!");
+        }
+
+        const ImageEntry& entry = *it->second;
+        if (!entry.ready.load(std::memory_order_acquire)) {
+            return entry.placeholder;
+        }
+
+        // Lookups are scaled by the size given to loadImage, which can exceed
+        // the decoded image; a texel past the end of a mapped cache file
+        // would fault, so stay on the image
+        if (entry.surface) {
+            return readSurfacePixel(entry.surface, std::clamp(x, 0, entry.surface->w - 1), std::clamp(y, 0, entry.surface->h - 1));
+        }
+        return entry.compressed.fetch(std::clamp(x, 0, entry.compressed.width - 1), std::clamp(y, 0, entry.compressed.height - 1));
+    }
+
+    // Average colour of the image, the placeholder until it is loaded
+    static Color getAverageColor(const std::string& key) {
+        auto it = images.find(key);
+        if (it == images.end()) {
+            throw std::runtime_error("Image key not found!");
+        }
+
+        const ImageEntry& entry = *it->second;
+        return entry.ready.load(std::memory_order_acquire) ? entry.average : entry.placeholder;
+    }
+
     static void render(SDL_Renderer* renderer, const std::string& key, int x, int y) {
-        auto it = imageSurfaces.find(key);
-        if (it == imageSurfaces.end()) {
+        auto it = images.find(key);
+        if (it == images.end()) {
             throw std::runtime_error("Image key not found!");
         }
 
-        SDL_Surface* targetSurface = it->second;
+        SDL_Surface* targetSurface = it->second->ready ? it->second->surface : nullptr;
+        if (!targetSurface) {
+            throw std::runtime_error("Image is not loaded as a surface!");
+        }
 
         // Convert surface to texture
         SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, targetSurface);
@@ -95,19 +288,30 @@ public:
 
     // Clean up
     static void cleanup() {
-        for (auto& pair : imageSurfaces) {
-            if (pair.second) {
-                SDL_FreeSurface(pair.second);
+        for (auto& pair : images) {
+            if (pair.second->surface) {
+                SDL_FreeSurface(pair.second->surface);
             }
         }
-        imageSurfaces.clear();
+        images.clear();
         IMG_Quit();
     }
 
+    // Grows every time an image finishes loading, so renderers can tell when
+    // placeholder colours they cached are stale
+    static int getReadyCount() {
+        return readyImages.load(std::memory_order_acquire);
+    }
+
     static glm::vec2 getImageSize(const std::string& key){
-        return imageSize[key];
+        auto it = imageSize.find(key);
+        if (it == imageSize.end()) {
+            throw std::runtime_error("Image key not found!");
+        }
+        return it->second;
     }
 };
 
-std::map<std::string, SDL_Surface*> ImageLoader::imageSurfaces;
+std::map<std::string, std::unique_ptr<ImageLoader::ImageEntry>> ImageLoader::images;
 std::map<std::string, glm::vec2> ImageLoader::imageSize;
+std::atomic<int> ImageLoader::readyImages{0};
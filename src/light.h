@@ -7,4 +7,5 @@ struct Light {
   glm::vec3 position;
   float intensity;
   Color color;
+  float radius = 0.0f;  // area light size for soft shadows in the stochastic render mode
 };
\ No newline at end of file
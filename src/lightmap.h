@@ -0,0 +1,408 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "aabb.h"
+#include "mappedfile.h"
+#include "intersect.h"
+#include "object.h"
+#include "parallel.h"
+
+// Direct lighting of one block face sampled on a grid of texels: the Lambert
+// factor towards the light and the shadow intensity castShadow returned.
+struct FaceLightmap {
+  int width = 0;     // texels along the face's first tangent axis
+  int height = 0;    // and along its second
+  bool dirty = true;
+  std::vector<float> diffuse;
+  std::vector<float> shadow;
+};
+
+struct BlockLightmap {
+  bool baked = false;    // moving blocks are never baked, they are lit live
+  AABB bounds = {glm::vec3(0.0f), glm::vec3(0.0f)};
+  FaceLightmap faces[6]; // -x, +x, -y, +y, -z, +z
+};
+
+// Baked shadows and diffuse factors for every static block face, kept in the
+// same order as the scene's objects. Faces are rebaked, in parallel, only
+// after an edit or a moving block touched a shadow ray of one of their texels
+// or the light moved. Lookups filter the four nearest texels.
+class Lightmaps {
+public:
+  static constexpr float TEXELS_PER_UNIT = 16.0f;
+  static constexpr int MAX_TEXELS = 64;
+
+  void reset(size_t objectCount) {
+    blocks.assign(objectCount, BlockLightmap());
+  }
+
+  // Mirrors a block appended to the objects
+  void insert(int object) {
+    if (object >= static_cast<int>(blocks.size())) {
+      blocks.resize(object + 1);
+    }
+    blocks[object] = BlockLightmap();
+  }
+
+  // Mirrors the swap-with-last removal of an object
+  void remove(int object) {
+    blocks[object] = std::move(blocks.back());
+    blocks.pop_back();
+  }
+
+  // Same baked texels for every block, ignoring which faces are still dirty
+  bool sameBake(const Lightmaps& other) const {
+    if (blocks.size() != other.blocks.size()) return false;
+    for (size_t k = 0; k < blocks.size(); k++) {
+      const BlockLightmap& a = blocks[k];
+      const BlockLightmap& b = other.blocks[k];
+      if (a.baked != b.baked) return false;
+      if (!a.baked) continue;
+      if (a.bounds.min != b.bounds.min || a.bounds.max != b.bounds.max) return false;
+      for (int f = 0; f < 6; f++) {
+        if (a.faces[f].diffuse != b.faces[f].diffuse || a.faces[f].shadow != b.faces[f].shadow) return false;
+      }
+    }
+    return true;
+  }
+
+  void invalidateAll() {
+    for (BlockLightmap& block : blocks) {
+      for (FaceLightmap& face : block.faces) {
+        face.dirty = true;
+      }
+    }
+  }
+
+  // Marks the faces with a texel whose shadow ray passes through region.
+  // Blocks, then faces, whose shadow rays cannot reach the region are skipped
+  // before any texel is tested.
+  void invalidate(const AABB& region, const glm::vec3& lightPosition) {
+    AABB box{region.min - glm::vec3(PADDING), region.max + glm::vec3(PADDING)};
+    parallelFor(0, static_cast<int>(blocks.size()), [&](int k) {
+      BlockLightmap& block = blocks[k];
+      if (!block.baked || !shadowMayCross(block.bounds, box, lightPosition)) return;
+      for (int f = 0; f < 6; f++) {
+        FaceLightmap& face = block.faces[f];
+        if (face.dirty || !shadowMayCross(faceBounds(block.bounds, f), box, lightPosition)) continue;
+        for (int t = 0; !face.dirty && t < face.width * face.height; t++) {
+          glm::vec3 point = texelPoint(block.bounds, f, face, t % face.width, t / face.width);
+          face.dirty = rayCrosses(box, point, lightPosition - point, INFINITE);
+        }
+      }
+    });
+  }
+
+  // Bakes every dirty face of the blocks not flagged as moving, shadow being
+  // castShadow(point, lightDir, object). Returns the number of faces baked.
+  template <typename Shadow>
+  int update(const std::vector<Object*>& objects, const std::vector<char>& moving, const glm::vec3& lightPosition, const Shadow& shadow) {
+    blocks.resize(objects.size());
+    if (lightPosition != light) {
+      light = lightPosition;
+      invalidateAll();
+    }
+
+    std::vector<std::pair<int, int>> work;
+    for (size_t k = 0; k < objects.size(); k++) {
+      BlockLightmap& block = blocks[k];
+      if (moving[k]) {
+        block = BlockLightmap();
+        continue;
+      }
+      AABB bounds = objects[k]->getBounds();
+      if (!block.baked || bounds.min != block.bounds.min || bounds.max != block.bounds.max) {
+        layout(block, bounds);
+      }
+      for (int f = 0; f < 6; f++) {
+        if (block.faces[f].dirty) work.emplace_back(static_cast<int>(k), f);
+      }
+    }
+
+    parallelFor(0, static_cast<int>(work.size()), [&](int i) {
+      int k = work[i].first;
+      int f = work[i].second;
+      BlockLightmap& block = blocks[k];
+      FaceLightmap& face = block.faces[f];
+      glm::vec3 normal = faceNormal(f);
+      for (int y = 0; y < face.height; y++) {
+        for (int x = 0; x < face.width; x++) {
+          glm::vec3 point = texelPoint(block.bounds, f, face, x, y);
+          glm::vec3 lightDir = glm::normalize(light - point);
+          face.diffuse[y * face.width + x] = std::max(0.0f, glm::dot(normal, lightDir));
+          face.shadow[y * face.width + x] = shadow(point, lightDir, k);
+        }
+      }
+      face.dirty = false;
+    });
+    return static_cast<int>(work.size());
+  }
+
+  // Baked diffuse factor and shadow at a hit on object, false when the object
+  // or face has no up to date bake
+  bool sample(int object, const Intersect& hit, float& diffuse, float& shadow) const {
+    if (object >= static_cast<int>(blocks.size()) || !blocks[object].baked) return false;
+    int axis = std::abs(hit.normal.x) > 0.5f ? 0 : (std::abs(hit.normal.y) > 0.5f ? 1 : (std::abs(hit.normal.z) > 0.5f ? 2 : -1));
+    if (axis < 0) return false;
+
+    const BlockLightmap& block = blocks[object];
+    int f = axis * 2 + (hit.normal[axis] > 0.0f ? 1 : 0);
+    const FaceLightmap& face = block.faces[f];
+    if (face.dirty) return false;
+
+    int u = (axis + 1) % 3;
+    int v = (axis + 2) % 3;
+    float fx = texelCoordinate(hit.point[u], block.bounds.min[u], block.bounds.max[u], face.width);
+    float fy = texelCoordinate(hit.point[v], block.bounds.min[v], block.bounds.max[v], face.height);
+    int x0 = static_cast<int>(fx);
+    int y0 = static_cast<int>(fy);
+    int x1 = std::min(x0 + 1, face.width - 1);
+    int y1 = std::min(y0 + 1, face.height - 1);
+    float tx = fx - x0;
+    float ty = fy - y0;
+
+    auto bilinear = [&](const std::vector<float>& texels) {
+      float top = texels[y0 * face.width + x0] * (1.0f - tx) + texels[y0 * face.width + x1] * tx;
+      float bottom = texels[y1 * face.width + x0] * (1.0f - tx) + texels[y1 * face.width + x1] * tx;
+      return top * (1.0f - ty) + bottom * ty;
+    };
+    diffuse = bilinear(face.diffuse);
+    shadow = bilinear(face.shadow);
+    return true;
+  }
+
+  // Identifies what a bake depends on: the light and every static block
+  static uint64_t sceneKey(const std::vector<Object*>& objects, const std::vector<char>& moving, const glm::vec3& lightPosition) {
+    uint64_t key = 14695981039346656037ull;
+    auto mix = [&](const void* data, size_t size) {
+      const unsigned char* bytes = static_cast<const unsigned char*>(data);
+      for (size_t i = 0; i < size; i++) {
+        key = (key ^ bytes[i]) * 1099511628211ull;
+      }
+    };
+    uint64_t count = objects.size();
+    mix(&count, sizeof(count));
+    mix(&lightPosition, sizeof(lightPosition));
+    float density = TEXELS_PER_UNIT;
+    mix(&density, sizeof(density));
+    for (size_t k = 0; k < objects.size(); k++) {
+      if (moving[k]) continue;
+      AABB bounds = objects[k]->getBounds();
+      mix(&k, sizeof(k));
+      mix(&bounds, sizeof(bounds));
+    }
+    return key;
+  }
+
+  // Writes every clean face together with the scene key and where the moving
+  // blocks were, since their shadows are part of the bake. Goes through a
+  // temporary name so a crash or a second process never leaves a torn file.
+  bool save(const std::string& path, uint64_t key, const std::vector<AABB>& movingBounds) const {
+    std::string tempPath = temporaryPath(path);
+    bool written;
+    {
+      std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+      FileHeader header = {};
+      std::memcpy(header.magic, "MCLM", 4);
+      header.version = 1;
+      header.key = key;
+      header.blockCount = static_cast<uint32_t>(blocks.size());
+      header.movingCount = static_cast<uint32_t>(movingBounds.size());
+      header.light[0] = light.x;
+      header.light[1] = light.y;
+      header.light[2] = light.z;
+      out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      out.write(reinterpret_cast<const char*>(movingBounds.data()), movingBounds.size() * sizeof(AABB));
+
+      for (const BlockLightmap& block : blocks) {
+        uint8_t baked = block.baked;
+        out.write(reinterpret_cast<const char*>(&baked), sizeof(baked));
+        if (!block.baked) continue;
+        out.write(reinterpret_cast<const char*>(&block.bounds), sizeof(block.bounds));
+        for (const FaceLightmap& face : block.faces) {
+          int32_t size[3] = {face.width, face.height, face.dirty};
+          out.write(reinterpret_cast<const char*>(size), sizeof(size));
+          out.write(reinterpret_cast<const char*>(face.diffuse.data()), face.diffuse.size() * sizeof(float));
+          out.write(reinterpret_cast<const char*>(face.shadow.data()), face.shadow.size() * sizeof(float));
+        }
+      }
+      written = static_cast<bool>(out);
+    }
+    std::error_code error;
+    if (written) {
+      std::filesystem::rename(tempPath, path, error);
+    }
+    if (!written || error) {
+      std::error_code ignored;
+      std::filesystem::remove(tempPath, ignored);
+      return false;
+    }
+    return true;
+  }
+
+  // Loads a bake written for the same scene key. The moving blocks' positions
+  // at bake time come back through movingBounds so their old shadows can be
+  // invalidated.
+  bool load(const std::string& path, uint64_t key, std::vector<AABB>& movingBounds) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    uint64_t fileSize = in ? static_cast<uint64_t>(in.tellg()) : 0;
+    in.seekg(0);
+    FileHeader header;
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, "MCLM", 4) != 0 || header.version != 1 || header.key != key) {
+      return false;
+    }
+    // Counts the file is too short to hold are corrupt, not something to allocate
+    if (static_cast<uint64_t>(header.movingCount) * sizeof(AABB) + header.blockCount > fileSize) {
+      return false;
+    }
+
+    movingBounds.resize(header.movingCount);
+    in.read(reinterpret_cast<char*>(movingBounds.data()), movingBounds.size() * sizeof(AABB));
+
+    std::vector<BlockLightmap> loaded(header.blockCount);
+    for (BlockLightmap& block : loaded) {
+      uint8_t baked = 0;
+      if (!in.read(reinterpret_cast<char*>(&baked), sizeof(baked))) return false;
+      block.baked = baked != 0;
+      if (!block.baked) continue;
+      if (!in.read(reinterpret_cast<char*>(&block.bounds), sizeof(block.bounds)) || !validBounds(block.bounds)) {
+        return false;
+      }
+
+      // Every face must have the 1..MAX_TEXELS layout its bounds give it,
+      // which sample and texelCoordinate rely on
+      glm::vec3 extent = block.bounds.max - block.bounds.min;
+      for (int f = 0; f < 6; f++) {
+        FaceLightmap& face = block.faces[f];
+        int axis = f / 2;
+        int32_t size[3];
+        if (!in.read(reinterpret_cast<char*>(size), sizeof(size)) ||
+            size[0] != texelCount(extent[(axis + 1) % 3]) || size[1] != texelCount(extent[(axis + 2) % 3])) {
+          return false;
+        }
+        face.width = size[0];
+        face.height = size[1];
+        face.dirty = size[2] != 0;
+        face.diffuse.resize(static_cast<size_t>(face.width) * face.height);
+        face.shadow.resize(face.diffuse.size());
+        in.read(reinterpret_cast<char*>(face.diffuse.data()), face.diffuse.size() * sizeof(float));
+        in.read(reinterpret_cast<char*>(face.shadow.data()), face.shadow.size() * sizeof(float));
+      }
+    }
+    if (!in) return false;
+
+    blocks.swap(loaded);
+    light = glm::vec3(header.light[0], header.light[1], header.light[2]);
+    return true;
+  }
+
+private:
+  struct FileHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t blockCount;
+    uint32_t movingCount;
+    float light[3];
+    uint32_t reserved;
+  };
+
+  static constexpr float PADDING = 0.001f;
+  static constexpr float INFINITE = 1e30f;
+
+  std::vector<BlockLightmap> blocks;
+  glm::vec3 light = glm::vec3(0.0f);
+
+  // Conservative test whether a shadow ray from some point of box, aimed at
+  // lightPosition and running on past it, can cross region. Compares the
+  // cones of directions the bounding spheres of the two boxes subtend from
+  // the light: the region is either between box and light, or past the light
+  // on the opposite side.
+  static bool shadowMayCross(const AABB& box, const AABB& region, const glm::vec3& lightPosition) {
+    glm::vec3 toBox = (box.min + box.max) * 0.5f - lightPosition;
+    glm::vec3 toRegion = (region.min + region.max) * 0.5f - lightPosition;
+    float boxRadius = glm::length(box.max - box.min) * 0.5f + PADDING;
+    float regionRadius = glm::length(region.max - region.min) * 0.5f + PADDING;
+    float boxDist = glm::length(toBox);
+    float regionDist = glm::length(toRegion);
+    if (boxDist <= boxRadius || regionDist <= regionRadius) return true;
+
+    float spread = std::asin(boxRadius / boxDist) + std::asin(regionRadius / regionDist);
+    if (spread >= 1.5f) return true;
+    float cosSpread = std::cos(spread) - 1e-4f;
+    float cosAngle = glm::dot(toBox, toRegion) / (boxDist * regionDist);
+    if (cosAngle >= cosSpread && regionDist - regionRadius <= boxDist + boxRadius) return true;
+    return -cosAngle >= cosSpread;
+  }
+
+  // Zero-thickness box of face f of a block
+  static AABB faceBounds(const AABB& bounds, int f) {
+    AABB face = bounds;
+    int axis = f / 2;
+    if (f % 2) face.min[axis] = bounds.max[axis];
+    else face.max[axis] = bounds.min[axis];
+    return face;
+  }
+
+  static glm::vec3 faceNormal(int f) {
+    glm::vec3 normal(0.0f);
+    normal[f / 2] = (f % 2) ? 1.0f : -1.0f;
+    return normal;
+  }
+
+  static bool validBounds(const AABB& bounds) {
+    for (int i = 0; i < 3; i++) {
+      if (!std::isfinite(bounds.min[i]) || !std::isfinite(bounds.max[i]) || bounds.min[i] > bounds.max[i]) return false;
+    }
+    return true;
+  }
+
+  static int texelCount(float extent) {
+    // Clamped as a float first so a huge extent never overflows the cast
+    float texels = std::min(std::ceil(extent * TEXELS_PER_UNIT), static_cast<float>(MAX_TEXELS));
+    return std::max(static_cast<int>(texels), 1);
+  }
+
+  void layout(BlockLightmap& block, const AABB& bounds) const {
+    block.baked = true;
+    block.bounds = bounds;
+    glm::vec3 extent = bounds.max - bounds.min;
+    for (int f = 0; f < 6; f++) {
+      int axis = f / 2;
+      FaceLightmap& face = block.faces[f];
+      face.width = texelCount(extent[(axis + 1) % 3]);
+      face.height = texelCount(extent[(axis + 2) % 3]);
+      face.diffuse.assign(static_cast<size_t>(face.width) * face.height, 0.0f);
+      face.shadow.assign(face.diffuse.size(), 1.0f);
+      face.dirty = true;
+    }
+  }
+
+  // Centre of texel (x, y) on face f of a block
+  static glm::vec3 texelPoint(const AABB& bounds, int f, const FaceLightmap& face, int x, int y) {
+    int axis = f / 2;
+    int u = (axis + 1) % 3;
+    int v = (axis + 2) % 3;
+    glm::vec3 point;
+    point[axis] = (f % 2) ? bounds.max[axis] : bounds.min[axis];
+    point[u] = bounds.min[u] + (bounds.max[u] - bounds.min[u]) * (x + 0.5f) / face.width;
+    point[v] = bounds.min[v] + (bounds.max[v] - bounds.min[v]) * (y + 0.5f) / face.height;
+    return point;
+  }
+
+  // Continuous texel position of a face coordinate, clamped to the texel centres
+  static float texelCoordinate(float value, float min, float max, int texels) {
+    float extent = max - min;
+    float t = extent > 0.0f ? (value - min) / extent * texels - 0.5f : 0.0f;
+    return std::clamp(t, 0.0f, static_cast<float>(texels - 1));
+  }
+};
@@ -1,7 +1,17 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_events.h>
 #include <SDL2/SDL_render.h>
+#include <cstdio>
+#include <climits>
 #include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <glm/ext/quaternion_geometric.hpp>
 #include <glm/geometric.hpp>
 #include <string>
@@ -17,6 +27,25 @@
 #include "cube.h"
 #include "imageloader.h"
 #include "skybox.h"
+#include "shading.h"
+#include "wavefront.h"
+#include "sampler.h"
+#include "parallel.h"
+#include "denoiser.h"
+#include "resolution.h"
+#include "upscaler.h"
+#include "threadpool.h"
+#include "distributed.h"
+#include "bvh.h"
+#include "animation.h"
+#include "pixelcache.h"
+#include "raygen.h"
+#include "screenbins.h"
+#include "shadinglod.h"
+#include "lightmap.h"
+#include "triplebuffer.h"
+#include "camerapath.h"
+#include "videostream.h"
 
 #include "./materials/netherrack.h"
 #include "./materials/obsidian.h"
@@ -28,90 +57,200 @@
 
 const int SCREEN_WIDTH = 800;
 const int SCREEN_HEIGHT = 600;
-const float ASPECT_RATIO = static_cast<float>(SCREEN_WIDTH) / static_cast<float>(SCREEN_HEIGHT);
+const float FOV = 3.1415/3;
 const int MAX_RECURSION = 3;
 const float BIAS = 0.0001f;
+const int SAMPLES_PER_PIXEL = 2;
+const float TARGET_FRAME_MS = 50.0f;
+const float MIN_RENDER_SCALE = 0.25f;
+const float MAX_RENDER_SCALE = 1.0f;
+const TextureFormat TEXTURE_FORMAT = TextureFormat::BC1;
+const char* TEXTURE_CACHE_DIR = "../cache";
+const char* LIGHTMAP_PATH = "../cache/lightmaps.bin";
+const float BLOCK_SIZE = 0.5f;
+
+enum class RenderMode {
+    Recursive,
+    Wavefront,
+    Denoised
+};
 
 SDL_Renderer* renderer;
+SDL_Texture* screenTexture;
 std::vector<Object*> objects;
 Light light = {
     glm::vec3(-10.0f, 10.0f, 20.0f), 
     1.0f, 
-    Color(255, 0,0)
+    Color(255, 0,0),
+    1.0f
 };
 Camera camera(glm::vec3(0.0, 0.0, 5.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), 10.0f);
+RenderMode renderMode = RenderMode::Recursive;
+WavefrontTracer wavefront(MAX_RECURSION, BIAS);
+std::vector<Color> framebuffer(SCREEN_WIDTH * SCREEN_HEIGHT);
+ResolutionController resolution(TARGET_FRAME_MS, MIN_RENDER_SCALE, MAX_RENDER_SCALE);
+bool dynamicResolution = true;
+GBuffer gbuffer;
+Denoiser denoiser;
+std::vector<float> noisyR, noisyG, noisyB;
+uint32_t frameIndex = 0;
+BVH bvh;
+std::vector<Animation> animations;
+bool animate = true;
+bool shadingLevels = true;  // input-side switch for shadingLOD, toggled with L
+Lightmaps lightmaps;
+bool bakedLighting = false;  // input-side switch for the lightmaps, toggled with B
+bool useLightmaps = false;   // render-side copy of bakedLighting
+float animationTime = 0.0f;
+PixelCache pixelCache;
+RayGenerator rayGenerator;
+ScreenBins screenBins;
+std::vector<AABB> dirtyRegions;  // space changed by edits and motion since the last frame
+int texturesSeen = -1;
+std::vector<std::function<Object*(const glm::vec3&, const glm::vec3&)>> blockPalette;
+int selectedBlock = 0;
+
+// Block edit requested by input, applied by the render thread between frames
+struct BlockEdit {
+    bool place;
+    int block;
+    Camera view;
+};
 
+// The main thread handles input and presentation, the render thread traces.
+// inputMutex guards camera, renderMode, dynamicResolution, animate and
+// pendingEdits; the render thread copies them when a frame starts.
+std::mutex inputMutex;
+std::vector<BlockEdit> pendingEdits;
+TripleBuffer<std::vector<Color>> displayFrames(std::vector<Color>(SCREEN_WIDTH * SCREEN_HEIGHT));
+std::atomic<bool> rendering{true};
+std::atomic<int> framesRendered{0};
+std::atomic<int> resolutionPercent{-1};  // -1 while dynamic resolution is off
 
-void point(glm::vec2 position, Color color) {
-    SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
-    SDL_RenderDrawPoint(renderer, position.x, position.y);
-}
 
 float castShadow(const glm::vec3& shadowOrigin, const glm::vec3& lightDir, Object* hitObject) {
-    for (auto& obj : objects) {
-        if (obj != hitObject) {
-            Intersect shadowIntersect = obj->rayIntersect(shadowOrigin, lightDir);
-            if (shadowIntersect.isIntersecting && shadowIntersect.dist > 0) {
-                float shadowRatio = shadowIntersect.dist / glm::length(light.position - shadowOrigin);
-                shadowRatio = glm::min(1.0f, shadowRatio);
-                return 1.0f - shadowRatio;
-            }
+    float occluderDist = 0.0f;
+    int occluder = bvh.first(shadowOrigin, lightDir, [&](int k) {
+        if (objects[k] == hitObject) return false;
+        Intersect shadowIntersect = objects[k]->rayIntersect(shadowOrigin, lightDir, 0.0f);
+        if (shadowIntersect.isIntersecting && shadowIntersect.dist > 0) {
+            occluderDist = shadowIntersect.dist;
+            return true;
         }
-    }
-    return 1.0f;
+        return false;
+    });
+    return occluder < 0 ? 1.0f : shadowFromOccluder(occluderDist, shadowOrigin, light);
 }
 
-Color castRay(const glm::vec3& rayOrigin, const glm::vec3& rayDirection, const short recursion = 0, Object* currentObj = nullptr) {
-    float zBuffer = 99999;
-    Object* hitObject = nullptr;
-    Intersect intersect;
+Intersect closestHit(const glm::vec3& rayOrigin, const glm::vec3& rayDirection, Object* currentObj, float pathDistance, int& hitIndex) {
+    // Keep the intersect of the current winner, using the same nearest then
+    // lowest-index rule as BVH::closest, so the hit is not intersected twice
+    Intersect best;
+    int bestIndex = -1;
+    hitIndex = bvh.closest(rayOrigin, rayDirection, 99999, [&](int k) {
+        if (objects[k] == currentObj) return -1.0f;
+        Intersect i = objects[k]->rayIntersect(rayOrigin, rayDirection, pathDistance);
+        if (!i.isIntersecting) return -1.0f;
+        if (bestIndex < 0 || i.dist < best.dist || (i.dist == best.dist && k < bestIndex)) {
+            best = i;
+            bestIndex = k;
+        }
+        return i.dist;
+    });
+    return hitIndex < 0 ? Intersect() : best;
+}
 
-    for (const auto& object : objects) {
-        Intersect i = object->rayIntersect(rayOrigin, rayDirection);
-        if (i.isIntersecting && i.dist < zBuffer && currentObj != object) {
-            zBuffer = i.dist;
-            hitObject = object;
-            intersect = i;
+// closestHit for the primary ray of a pixel, testing only the objects binned
+// into its screen tile
+Intersect primaryHit(const glm::vec3& rayOrigin, const glm::vec3& rayDirection, int pixel, int& hitIndex) {
+    // Candidates come in ascending order, so the first of equally near hits wins
+    Intersect best;
+    bool found = false;
+    hitIndex = screenBins.closest(screenBins.tileOf(pixel), 99999, [&](int k) {
+        Intersect i = objects[k]->rayIntersect(rayOrigin, rayDirection, 0.0f);
+        if (!i.isIntersecting) return -1.0f;
+        if (!found || i.dist < best.dist) {
+            best = i;
+            found = true;
         }
-    }
+        return i.dist;
+    });
+    return hitIndex < 0 ? Intersect() : best;
+}
 
-    if (!intersect.isIntersecting || recursion == MAX_RECURSION) {
-        // return Color(173, 216, 230);
-        return Skybox::getColor(rayOrigin, rayDirection);
+// Moves the animated blocks to where they are at `time`, refits the BVH
+// around them and marks the space they swept as dirty
+void updateScene(float time) {
+    for (const Animation& animation : animations) {
+        AABB before = objects[animation.object]->getBounds();
+        animation.apply(time);
+        AABB after = objects[animation.object]->getBounds();
+        bvh.refit(animation.object, after);
+        dirtyRegions.push_back(AABB{glm::min(before.min, after.min), glm::max(before.max, after.max)});
     }
+    bvh.maintain();
+}
 
-    glm::vec3 lightDir = glm::normalize(light.position - intersect.point);
-    glm::vec3 viewDir = glm::normalize(rayOrigin - intersect.point);
-    glm::vec3 reflectDir = glm::reflect(-glm::normalize(rayOrigin), intersect.normal);     
+Color castRay(const glm::vec3& rayOrigin, const glm::vec3& rayDirection, const short recursion = 0, Object* currentObj = nullptr, Sampler* sampler = nullptr, float pathDistance = 0.0f);
 
-    float shadowIntensity = castShadow(intersect.point, lightDir, hitObject);
+// Shading of a known hit. With a sampler the shadow ray targets a random point
+// on the light and rough materials jitter their reflection, one sample per call.
+// pathDistance is how far the camera is from rayOrigin along the ray path.
+Color shadeHit(const Intersect& intersect, int hitIndex, const glm::vec3& rayOrigin, const glm::vec3& rayDirection, const short recursion, Sampler* sampler, float pathDistance) {
+    Object* hitObject = objects[hitIndex];
+    glm::vec3 lightDir = glm::normalize(light.position - intersect.point);
+    glm::vec3 reflectDir = reflectDirection(rayOrigin, intersect.normal);
 
-    float diffuseLightIntensity = std::max(0.0f, glm::dot(intersect.normal, lightDir));
-    float specReflection = glm::dot(viewDir, reflectDir);
-    
     Material mat = hitObject->material;
 
-    float specLightIntensity = std::pow(std::max(0.0f, glm::dot(viewDir, reflectDir)), mat.specularCoefficient);
+    // A lightmap replaces the shadow ray and Lambert term of static blocks;
+    // the stochastic mode keeps its soft shadows
+    float bakedDiffuse;
+    float shadowIntensity;
+    bool baked = useLightmaps && !sampler && lightmaps.sample(hitIndex, intersect, bakedDiffuse, shadowIntensity);
+    if (!baked) {
+        glm::vec3 shadowDir = lightDir;
+        if (sampler && light.radius > 0) {
+            glm::vec3 lightSample = light.position + sampler->inUnitSphere() * light.radius;
+            shadowDir = glm::normalize(lightSample - intersect.point);
+        }
+        shadowIntensity = castShadow(intersect.point, shadowDir, hitObject);
+    }
+
+    // Far primary hits fade their bounces into the sky instead of tracing them
+    float bounceDetail = recursion == 0 ? shadingLOD.bounceDetail(intersect.dist) : 1.0f;
 
     Color reflectedColor(0.0f, 0.0f, 0.0f);
     if (mat.reflectivity > 0) {
         glm::vec3 origin = intersect.point + intersect.normal * BIAS;
-        reflectedColor = castRay(origin, reflectDir, recursion + 1, hitObject); 
+        glm::vec3 dir = (sampler && mat.roughness > 0) ? sampler->perturb(reflectDir, mat.roughness) : reflectDir;
+        Color traced = bounceDetail > 0.0f ? castRay(origin, dir, recursion + 1, hitObject, sampler, pathDistance + intersect.dist) : reflectedColor;
+        reflectedColor = fadeDetail(traced, bounceDetail < 1.0f ? Skybox::getColor(origin, dir) : traced, bounceDetail);
     }
 
     Color refractedColor(0.0f, 0.0f, 0.0f);
     if (mat.transparency > 0) {
         glm::vec3 origin = intersect.point - intersect.normal * BIAS;
         glm::vec3 refractDir = glm::refract(rayDirection, intersect.normal, mat.refractionIndex);
-        refractedColor = castRay(origin, refractDir, recursion + 1, hitObject); 
+        Color traced = bounceDetail > 0.0f ? castRay(origin, refractDir, recursion + 1, hitObject, sampler, pathDistance + intersect.dist) : refractedColor;
+        refractedColor = fadeDetail(traced, bounceDetail < 1.0f ? Skybox::getColor(origin, refractDir) : traced, bounceDetail);
     }
 
-    Color materialLight = intersect.hasColor ? intersect.color : mat.diffuse;
+    Color direct = baked ? directLight(intersect, mat, light, rayOrigin, shadowIntensity, bakedDiffuse)
+                         : directLight(intersect, mat, light, rayOrigin, shadowIntensity);
+    return composite(direct, mat, reflectedColor, refractedColor);
+}
+
+Color castRay(const glm::vec3& rayOrigin, const glm::vec3& rayDirection, const short recursion, Object* currentObj, Sampler* sampler, float pathDistance) {
+    int hitIndex;
+    Intersect intersect = closestHit(rayOrigin, rayDirection, currentObj, pathDistance, hitIndex);
 
-    Color diffuseLight = materialLight * light.intensity * diffuseLightIntensity * mat.albedo * shadowIntensity;
-    Color specularLight = light.color * light.intensity * specLightIntensity * mat.specularAlbedo * shadowIntensity;
-    Color color = (diffuseLight + specularLight) * (1.0f - mat.reflectivity - mat.transparency) + reflectedColor * mat.reflectivity + refractedColor * mat.transparency;
-    return color;
+    if (!intersect.isIntersecting || recursion == MAX_RECURSION) {
+        // return Color(173, 216, 230);
+        return Skybox::getColor(rayOrigin, rayDirection);
+    }
+
+    return shadeHit(intersect, hitIndex, rayOrigin, rayDirection, recursion, sampler, pathDistance);
 } 
 
 void setUp() {
@@ -141,7 +280,8 @@ void setUp() {
         0.4f,                
         0.6f,                 
         0.0f,                 
-        1.5f                  
+        1.5f,                 
+        0.15f                 
     };
 
     Material diamond = {
@@ -151,7 +291,8 @@ void setUp() {
         0.8f,                
         0.8f,                  
         0.0f,                  
-        2.4f                   
+        2.4f,                  
+        0.05f                  
     };
 
     Material netherrack = {
@@ -208,37 +349,807 @@ void setUp() {
     objects.push_back(new Gold(glm::vec3(-1.5f, 0.0f, -3.0f), glm::vec3(0.5f, 2.1f, -4.0f), gold)); 
 
     objects.push_back(new Diamond(glm::vec3(1.0f, 0.0f, -3.0f), glm::vec3(3.0f, 2.1f, -4.0f), diamond));
-    
+
+    // A gold block circling above the portal and a netherrack block bobbing next to it
+    Gold* orbiting = new Gold(glm::vec3(-0.45f, 4.0f, -1.45f), glm::vec3(-0.05f, 4.4f, -1.05f), gold);
+    objects.push_back(orbiting);
+    animations.push_back(Animation(objects.size() - 1, orbiting, glm::vec3(0.0f, 0.0f, 1.2f), glm::vec3(-1.2f, 0.0f, 0.0f), 6.0f));
+
+    Netherrack* bobbing = new Netherrack(glm::vec3(-3.0f, 0.0f, -2.0f), glm::vec3(-2.5f, 0.5f, -2.5f), netherrack);
+    objects.push_back(bobbing);
+    animations.push_back(Animation(objects.size() - 1, bobbing, glm::vec3(0.0f, 0.75f, 0.0f), glm::vec3(0.0f), 3.0f));
+
+    // Blocks that can be placed with the right mouse button, picked with 1-5
+    blockPalette = {
+        [=](const glm::vec3& min, const glm::vec3& max) -> Object* { return new Stone(min, max, stone); },
+        [=](const glm::vec3& min, const glm::vec3& max) -> Object* { return new Netherrack(min, max, netherrack); },
+        [=](const glm::vec3& min, const glm::vec3& max) -> Object* { return new Obsidian(min, max, obsidian); },
+        [=](const glm::vec3& min, const glm::vec3& max) -> Object* { return new Gold(min, max, gold); },
+        [=](const glm::vec3& min, const glm::vec3& max) -> Object* { return new Diamond(min, max, diamond); }
+    };
+
+    std::vector<AABB> bounds(objects.size());
+    for (size_t k = 0; k < objects.size(); k++) {
+        bounds[k] = objects[k]->getBounds();
+    }
+    bvh.build(bounds);
+    lightmaps.reset(objects.size());
+    updateScene(animationTime);
+}
+
+// Block under the crosshair, -1 when the centre of the screen shows the sky
+int pickBlock(const Camera& view, Intersect& hit) {
+    int hitIndex;
+    hit = closestHit(view.position, glm::normalize(view.target - view.position), nullptr, 0.0f, hitIndex);
+    return hitIndex;
+}
+
+void removeBlock(const Camera& view) {
+    Intersect hit;
+    int index = pickBlock(view, hit);
+    if (index < 0) return;
+
+    // The last object takes over the freed slot, which changes its place in
+    // the object order that shadow rays and ties depend on
+    int last = static_cast<int>(objects.size()) - 1;
+    dirtyRegions.push_back(objects[index]->getBounds());
+    if (index != last) {
+        dirtyRegions.push_back(objects[last]->getBounds());
+    }
+
+    animations.erase(std::remove_if(animations.begin(), animations.end(),
+                                    [&](const Animation& animation) { return animation.object == index; }),
+                     animations.end());
+    for (Animation& animation : animations) {
+        if (animation.object == last) animation.object = index;
+    }
+
+    bvh.remove(index);
+    lightmaps.remove(index);
+    delete objects[index];
+    objects[index] = objects[last];
+    objects.pop_back();
+    bvh.maintain();
+}
+
+// Puts a block of the given palette entry against the face under the crosshair,
+// snapped to the block grid along the face
+void placeBlock(const Camera& view, int block) {
+    Intersect hit;
+    if (pickBlock(view, hit) < 0) return;
+
+    glm::vec3 min = glm::floor(hit.point / BLOCK_SIZE) * BLOCK_SIZE;
+    for (int axis = 0; axis < 3; axis++) {
+        if (hit.normal[axis] > 0.5f) min[axis] = hit.point[axis];
+        else if (hit.normal[axis] < -0.5f) min[axis] = hit.point[axis] - BLOCK_SIZE;
+    }
+    glm::vec3 max = min + glm::vec3(BLOCK_SIZE);
+
+    objects.push_back(blockPalette[block](min, max));
+    bvh.insert(static_cast<int>(objects.size()) - 1, AABB{min, max});
+    lightmaps.insert(static_cast<int>(objects.size()) - 1);
+    dirtyRegions.push_back(AABB{min, max});
+    bvh.maintain();
+}
+
+// Flags for the objects that animate, which are never baked
+std::vector<char> movingObjects() {
+    std::vector<char> moving(objects.size(), 0);
+    for (const Animation& animation : animations) {
+        moving[animation.object] = 1;
+    }
+    return moving;
+}
+
+// Rebakes every lightmap face that is out of date
+void updateLightmaps(Lightmaps& target = lightmaps) {
+    target.update(objects, movingObjects(), light.position, [](const glm::vec3& point, const glm::vec3& lightDir, int k) {
+        return castShadow(point, lightDir, objects[k]);
+    });
+}
+
+// Bounds of the animated blocks where they are now
+std::vector<AABB> movingBounds() {
+    std::vector<AABB> bounds;
+    for (const Animation& animation : animations) {
+        bounds.push_back(objects[animation.object]->getBounds());
+    }
+    return bounds;
+}
+
+// Loads the bake at path if it was made for this scene and light. Shadows of
+// the moving blocks are baked where they were back then, so those places and
+// where the blocks are now are marked dirty for the next update.
+bool loadLightmaps(const std::string& path) {
+    uint64_t key = Lightmaps::sceneKey(objects, movingObjects(), light.position);
+    std::vector<AABB> movedBounds;
+    if (!lightmaps.load(path, key, movedBounds)) return false;
+    for (const AABB& region : movingBounds()) {
+        movedBounds.push_back(region);
+    }
+    for (const AABB& region : movedBounds) {
+        lightmaps.invalidate(region, light.position);
+    }
+    return true;
+}
+
+bool saveLightmaps(const std::string& path) {
+    uint64_t key = Lightmaps::sceneKey(objects, movingObjects(), light.position);
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+    if (!lightmaps.save(path, key, movingBounds())) {
+        SDL_Log("Unable to save lightmaps to %s", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Turns baked lighting on: reuses the bake on disk when it was made for this
+// scene and light, otherwise bakes every static face and saves the result
+void enableLightmaps() {
+    Uint32 start = SDL_GetTicks();
+    bool loaded = loadLightmaps(LIGHTMAP_PATH);
+    if (!loaded) {
+        lightmaps.reset(objects.size());
+    }
+    updateLightmaps();
+
+    if (!loaded) {
+        saveLightmaps(LIGHTMAP_PATH);
+    }
+    SDL_Log("Lightmaps %s in %u ms", loaded ? "loaded" : "baked", SDL_GetTicks() - start);
+}
+
+void renderWavefront(const Camera& view, int width, int height) {
+    wavefront.beginFrame();
+    // Runs of pixels that need tracing go in straight from the direction table
+    for (int y = 0; y < height; y++) {
+        int x = 0;
+        while (x < width) {
+            if (pixelCache.isValid(y * width + x)) {
+                x++;
+                continue;
+            }
+            int start = x;
+            while (x < width && !pixelCache.isValid(y * width + x)) {
+                x++;
+            }
+            wavefront.addPrimaryRays(view.position, rayGenerator.rowX(y) + start, rayGenerator.rowY(y) + start,
+                                     rayGenerator.rowZ(y) + start, y * width + start, x - start);
+        }
+    }
+
+    wavefront.trace(objects, light, framebuffer, &screenBins, useLightmaps ? &lightmaps : nullptr, &bvh);
+
+    const RayQueue& primary = wavefront.primaryRays();
+    for (size_t i = 0; i < primary.size(); i++) {
+        int hitIndex = primary.hitObject[i];
+        if (hitIndex < 0) {
+            pixelCache.record(primary.parent[i], primary.direction(i), nullptr, false);
+        } else {
+            const Material& mat = objects[hitIndex]->material;
+            pixelCache.record(primary.parent[i], primary.direction(i), &primary.hits[i], mat.reflectivity > 0 || mat.transparency > 0);
+        }
+    }
+}
+
+// Low sample count path: a few stochastic samples per pixel plus a G-buffer,
+// then an edge-aware filter over the demodulated irradiance
+void renderDenoised(const Camera& view, int width, int height) {
+    const int pixelCount = width * height;
+    gbuffer.resize(width, height);
+    noisyR.resize(pixelCount);
+    noisyG.resize(pixelCount);
+    noisyB.resize(pixelCount);
+
+    parallelFor(0, height, [&](int y) {
+        for (int x = 0; x < width; x++) {
+            int pixel = y * width + x;
+            glm::vec3 rayDirection = rayGenerator.direction(pixel);
+
+            int hitIndex;
+            Intersect intersect = primaryHit(view.position, rayDirection, pixel, hitIndex);
+            if (!intersect.isIntersecting) {
+                Color sky = Skybox::getColor(view.position, rayDirection);
+                gbuffer.objectId[pixel] = -1;
+                gbuffer.albedoR[pixel] = gbuffer.albedoG[pixel] = gbuffer.albedoB[pixel] = 1.0f;
+                noisyR[pixel] = sky.r / 255.0f;
+                noisyG[pixel] = sky.g / 255.0f;
+                noisyB[pixel] = sky.b / 255.0f;
+                continue;
+            }
+
+            Object* hitObject = objects[hitIndex];
+            Color albedo = intersect.hasColor ? intersect.color : hitObject->material.diffuse;
+            gbuffer.objectId[pixel] = hitIndex;
+            gbuffer.depth[pixel] = intersect.dist;
+            gbuffer.normalX[pixel] = intersect.normal.x;
+            gbuffer.normalY[pixel] = intersect.normal.y;
+            gbuffer.normalZ[pixel] = intersect.normal.z;
+            // Floor the albedo so black texels do not blow up the demodulation
+            gbuffer.albedoR[pixel] = std::max(albedo.r / 255.0f, 0.02f);
+            gbuffer.albedoG[pixel] = std::max(albedo.g / 255.0f, 0.02f);
+            gbuffer.albedoB[pixel] = std::max(albedo.b / 255.0f, 0.02f);
+
+            Sampler sampler(pixel, frameIndex);
+            float r = 0.0f, g = 0.0f, b = 0.0f;
+            for (int s = 0; s < SAMPLES_PER_PIXEL; s++) {
+                Color c = shadeHit(intersect, hitIndex, view.position, rayDirection, 0, &sampler, 0.0f);
+                r += c.r;
+                g += c.g;
+                b += c.b;
+            }
+            float norm = 1.0f / (SAMPLES_PER_PIXEL * 255.0f);
+            noisyR[pixel] = r * norm / gbuffer.albedoR[pixel];
+            noisyG[pixel] = g * norm / gbuffer.albedoG[pixel];
+            noisyB[pixel] = b * norm / gbuffer.albedoB[pixel];
+        }
+    });
+
+    denoiser.filter(gbuffer, noisyR, noisyG, noisyB);
+
+    for (int pixel = 0; pixel < pixelCount; pixel++) {
+        framebuffer[pixel] = Color(
+            static_cast<int>(noisyR[pixel] * gbuffer.albedoR[pixel] * 255.0f),
+            static_cast<int>(noisyG[pixel] * gbuffer.albedoG[pixel] * 255.0f),
+            static_cast<int>(noisyB[pixel] * gbuffer.albedoB[pixel] * 255.0f)
+        );
+    }
+    frameIndex++;
+}
+
+// Traces one frame at the given internal resolution into framebuffer
+void render(const Camera& view, RenderMode mode, int width, int height) {
+    float fov = FOV;
+    framebuffer.resize(width * height);
+
+    // Decide which pixels of the last frame can be kept: none after the view
+    // changed, a texture finished loading or a denoised frame; otherwise all
+    // but those whose rays reach space that was edited or moved through
+    pixelCache.beginFrame(view, width, height);
+    float aspectRatio = static_cast<float>(width) / static_cast<float>(height);
+    rayGenerator.update(view, width, height, fov, aspectRatio);
+    screenBins.build(view, width, height, fov, aspectRatio, objects);
+    int readyTextures = ImageLoader::getReadyCount();
+    if (readyTextures != texturesSeen || mode == RenderMode::Denoised) {
+        pixelCache.invalidateAll();
+        texturesSeen = readyTextures;
+    } else {
+        // Lightmap lookups blend neighbouring texels, so pixels next to a
+        // changed shadow are dropped as well
+        glm::vec3 pad(useLightmaps ? 2.0f / Lightmaps::TEXELS_PER_UNIT : 0.0f);
+        for (const AABB& region : dirtyRegions) {
+            pixelCache.invalidate(AABB{region.min - pad, region.max + pad}, light.position);
+        }
+    }
+    if (useLightmaps) {
+        for (const AABB& region : dirtyRegions) {
+            lightmaps.invalidate(region, light.position);
+        }
+        updateLightmaps();
+    }
+    dirtyRegions.clear();
+
+    if (mode == RenderMode::Wavefront) {
+        renderWavefront(view, width, height);
+        return;
+    }
+    if (mode == RenderMode::Denoised) {
+        renderDenoised(view, width, height);
+        return;
+    }
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int pixel = y * width + x;
+            if (pixelCache.isValid(pixel)) continue;
+
+            glm::vec3 rayDirection = rayGenerator.direction(pixel);
+
+            // castRay, keeping the primary hit for the pixel cache
+            int hitIndex;
+            Intersect intersect = primaryHit(view.position, rayDirection, pixel, hitIndex);
+            if (!intersect.isIntersecting) {
+                framebuffer[pixel] = Skybox::getColor(view.position, rayDirection);
+                pixelCache.record(pixel, rayDirection, nullptr, false);
+                continue;
+            }
+
+            const Material& mat = objects[hitIndex]->material;
+            framebuffer[pixel] = shadeHit(intersect, hitIndex, view.position, rayDirection, 0, nullptr, 0.0f);
+            pixelCache.record(pixel, rayDirection, &intersect, mat.reflectivity > 0 || mat.transparency > 0);
+        }
+    }
+}
+
+// count pixels of row y of an arbitrary width x height view starting at column
+// x, traced without the interactive caches so any number of threads can share
+// the scene
+void traceRow(const Camera& view, int y, int x, int count, int width, int height, Color* out) {
+    float aspectRatio = static_cast<float>(width) / static_cast<float>(height);
+    for (int i = 0; i < count; i++) {
+        glm::vec3 rayDirection = RayGenerator::direction(view, x + i, y, width, height, FOV, aspectRatio);
+        out[i] = castRay(view.position, rayDirection);
+    }
+}
+
+// Tile of a frame seen from an arbitrary view, used by distributed workers
+void renderTile(const TileJob& job, std::vector<Color>& pixels) {
+    Camera view(
+        glm::vec3(job.position[0], job.position[1], job.position[2]),
+        glm::vec3(job.target[0], job.target[1], job.target[2]),
+        glm::vec3(job.up[0], job.up[1], job.up[2]),
+        camera.rotationSpeed
+    );
+
+    parallelFor(0, job.h, [&](int row) {
+        traceRow(view, job.y + row, job.x, job.w, job.width, job.height, &pixels[row * job.w]);
+    });
+}
+
+bool writePPM(const std::string& path, const std::vector<Color>& pixels, int width, int height) {
+    std::ofstream out(path, std::ios::binary);
+    out << "P6\n" << width << " " << height << "\n255\n";
+    for (const Color& c : pixels) {
+        out.put(c.r).put(c.g).put(c.b);
+    }
+    return static_cast<bool>(out);
+}
+
+// Draws a finished window-sized frame with the crosshair on top
+void present(const std::vector<Color>& frame) {
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderClear(renderer);
+    SDL_UpdateTexture(screenTexture, NULL, frame.data(), SCREEN_WIDTH * sizeof(Color));
+    SDL_RenderCopy(renderer, screenTexture, NULL, NULL);
+
+    // Crosshair for picking blocks
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderDrawLine(renderer, SCREEN_WIDTH / 2 - 6, SCREEN_HEIGHT / 2, SCREEN_WIDTH / 2 + 6, SCREEN_HEIGHT / 2);
+    SDL_RenderDrawLine(renderer, SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2 - 6, SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2 + 6);
+}
+
+void loadTextures(ThreadPool& pool) {
+    ImageLoader::init();
+
+    ImageLoader::loadImageAsync(pool, "grass", "../assets/grama.jpg", 800.0f, 800.0f, TEXTURE_FORMAT, Color(95, 159, 53), TEXTURE_CACHE_DIR);
+    ImageLoader::loadImageAsync(pool, "obsidian", "../assets/obsidian.jpg", 512.0f, 512.0f, TEXTURE_FORMAT, Color(20, 18, 29), TEXTURE_CACHE_DIR);
+    ImageLoader::loadImageAsync(pool, "portal", "../assets/portal.jpg", 160.0f, 160.0f, TEXTURE_FORMAT, Color(128, 0, 128), TEXTURE_CACHE_DIR);
+    ImageLoader::loadImageAsync(pool, "gold", "../assets/gold.jpg", 512.0f, 512.0f, TEXTURE_FORMAT, Color(255, 215, 0), TEXTURE_CACHE_DIR);
+    ImageLoader::loadImageAsync(pool, "diamond", "../assets/diamond.jpg", 300.0f, 300.0f, TEXTURE_FORMAT, Color(127, 213, 240), TEXTURE_CACHE_DIR);
+    ImageLoader::loadImageAsync(pool, "netherrack", "../assets/netherrack.jpeg", 400.0f, 400.0f, TEXTURE_FORMAT, Color(153, 25, 25), TEXTURE_CACHE_DIR);
+    ImageLoader::loadImageAsync(pool, "stone", "../assets/stone.png", 800.0f, 800.0f, TEXTURE_FORMAT, Color(128, 128, 128), TEXTURE_CACHE_DIR);
+
+    ImageLoader::loadImageAsync(pool, "upSky", "../assets/ceil.jpg", 4096.0f, 434.0f, TEXTURE_FORMAT, Color(173, 216, 230), TEXTURE_CACHE_DIR);
+    ImageLoader::loadImageAsync(pool, "sideSky", "../assets/skybox.jpg", 4096.0f, 2160.0f, TEXTURE_FORMAT, Color(173, 216, 230), TEXTURE_CACHE_DIR);
+    ImageLoader::loadImageAsync(pool, "floor", "../assets/floor.jpg", 1200.0f, 200.0f, TEXTURE_FORMAT, Color(173, 216, 230), TEXTURE_CACHE_DIR);
+}
+
+// Render thread: each frame starts from the newest input, applies queued
+// edits and motion, traces, and upscales into the triple buffer while the
+// main thread keeps handling input and presenting the previous frame
+void renderLoop() {
+    Uint64 lastStart = SDL_GetPerformanceCounter();
+    while (rendering) {
+        Uint64 frameStart = SDL_GetPerformanceCounter();
+        float sinceLastFrame = (frameStart - lastStart) * 1.0f / SDL_GetPerformanceFrequency();
+        lastStart = frameStart;
+
+        std::unique_lock<std::mutex> lock(inputMutex);
+        Camera view = camera;
+        RenderMode mode = renderMode;
+        bool scaleResolution = dynamicResolution;
+        bool moving = animate;
+        bool levels = shadingLevels;
+        bool baked = bakedLighting;
+        std::vector<BlockEdit> edits;
+        edits.swap(pendingEdits);
+        lock.unlock();
+
+        for (const BlockEdit& edit : edits) {
+            if (edit.place) placeBlock(edit.view, edit.block);
+            else removeBlock(edit.view);
+        }
+        if (moving) {
+            animationTime += sinceLastFrame;
+            updateScene(animationTime);
+        }
+        if (levels != shadingLOD.enabled) {
+            shadingLOD.enabled = levels;
+            pixelCache.invalidateAll();
+        }
+        if (baked != useLightmaps) {
+            useLightmaps = baked;
+            if (baked) enableLightmaps();
+            pixelCache.invalidateAll();
+        }
+
+        int renderWidth = scaleResolution ? resolution.scaledWidth(SCREEN_WIDTH) : SCREEN_WIDTH;
+        int renderHeight = scaleResolution ? resolution.scaledHeight(SCREEN_WIDTH, SCREEN_HEIGHT) : SCREEN_HEIGHT;
+        render(view, mode, renderWidth, renderHeight);
+        Upscaler::bilinear(framebuffer, renderWidth, renderHeight, displayFrames.writeBuffer(), SCREEN_WIDTH, SCREEN_HEIGHT);
+        displayFrames.publish();
+
+        float frameMs = (SDL_GetPerformanceCounter() - frameStart) * 1000.0f / SDL_GetPerformanceFrequency();
+        if (scaleResolution) {
+            resolution.update(frameMs);
+        }
+        resolutionPercent = scaleResolution ? static_cast<int>(resolution.getScale() * 100.0f) : -1;
+        framesRendered++;
+    }
+}
+
+struct Options {
+    std::string worker;         // host:port of the coordinator to serve
+    bool coordinator = false;
+    int port = 7878;
+    int spawn = 0;              // local worker processes started by the coordinator
+    int frames = 1;
+    int width = SCREEN_WIDTH;
+    int height = SCREEN_HEIGHT;
+    int tileSize = 64;
+    std::string output = "frame";
+    std::string cameraPath;     // keyframe file for batch rendering to stdout
+    int fps = 30;
+    std::string videoFormat = "y4m";
+    int benchFrames = 0;        // cold frames timed per render mode, 0 to run interactively
+    bool check = false;         // self-test of the incremental paths instead of the window
+};
+
+// Whole-string integer within [min, max]
+bool parseInt(const char* text, int min, int max, int& value) {
+    char* end;
+    long parsed = std::strtol(text, &end, 10);
+    if (end == text || *end != '\0' || parsed < min || parsed > max) return false;
+    value = static_cast<int>(parsed);
+    return true;
+}
+
+// Fills options from the command line; logs and returns false on a malformed
+// or out of range value
+bool parseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        bool valid = true;
+        if (arg == "--worker" && hasValue) options.worker = argv[++i];
+        else if (arg == "--coordinator") options.coordinator = true;
+        else if (arg == "--check") options.check = true;
+        else if (arg == "--port" && hasValue) valid = parseInt(argv[++i], 1, 65535, options.port);
+        else if (arg == "--spawn" && hasValue) valid = parseInt(argv[++i], 0, 256, options.spawn);
+        else if (arg == "--frames" && hasValue) valid = parseInt(argv[++i], 1, INT_MAX, options.frames);
+        else if (arg == "--tile" && hasValue) valid = parseInt(argv[++i], 1, 4096, options.tileSize);
+        else if (arg == "--out" && hasValue) options.output = argv[++i];
+        else if (arg == "--path" && hasValue) options.cameraPath = argv[++i];
+        else if (arg == "--fps" && hasValue) valid = parseInt(argv[++i], 1, 1000, options.fps);
+        else if (arg == "--format" && hasValue) {
+            options.videoFormat = argv[++i];
+            valid = options.videoFormat == "y4m" || options.videoFormat == "rgba";
+        }
+        else if (arg == "--bench" && hasValue) valid = parseInt(argv[++i], 1, INT_MAX, options.benchFrames);
+        else if (arg == "--size" && hasValue) {
+            char extra;
+            valid = std::sscanf(argv[++i], "%dx%d%c", &options.width, &options.height, &extra) == 2 &&
+                    options.width > 0 && options.height > 0 && options.width <= 16384 && options.height <= 16384;
+        }
+        else SDL_Log("Ignoring unknown argument %s", arg.c_str());
+
+        if (!valid) {
+            SDL_Log("Invalid value %s for %s", argv[i], arg.c_str());
+            return false;
+        }
+    }
+    return true;
 }
 
-void render() {
-    float fov = 3.1415/3;
-    for (int y = 0; y < SCREEN_HEIGHT; y++) {
-        for (int x = 0; x < SCREEN_WIDTH; x++) {
+// Headless worker: loads the scene and renders tiles for a coordinator
+int runWorker(const Options& options) {
+    size_t colon = options.worker.rfind(':');
+    std::string host = colon == std::string::npos ? options.worker : options.worker.substr(0, colon);
+    int port = options.port;
+    if (colon != std::string::npos && !parseInt(options.worker.c_str() + colon + 1, 1, 65535, port)) {
+        SDL_Log("Invalid port in %s", options.worker.c_str());
+        return 1;
+    }
 
-            float screenX = (2.0f * (x + 0.5f)) / SCREEN_WIDTH - 1.0f;
-            float screenY = -(2.0f * (y + 0.5f)) / SCREEN_HEIGHT + 1.0f;
-            screenX *= ASPECT_RATIO;
-            screenX *= tan(fov/2.0f);
-            screenY *= tan(fov/2.0f);
+    ThreadPool assetPool;
+    loadTextures(assetPool);
+    assetPool.wait();
+    setUp();
+
+    return runTileWorker(host, static_cast<uint16_t>(port), renderTile);
+}
 
+// Headless coordinator: splits a camera orbit of options.frames frames into
+// tiles, farms them out to worker processes and writes one PPM per frame
+int runCoordinator(const Options& options, const char* executable) {
+    RenderCoordinator coordinator(static_cast<uint16_t>(options.port), options.tileSize);
+    if (!coordinator.isListening()) {
+        SDL_Log("Unable to listen on port %d", options.port);
+        return 1;
+    }
 
-            glm::vec3 cameraDir = glm::normalize(camera.target - camera.position);
+    std::string workerCommand = std::string("\"") + executable + "\" --worker 127.0.0.1:" + std::to_string(options.port);
+    for (int i = 0; i < options.spawn; i++) {
+        std::thread([workerCommand]() { std::system(workerCommand.c_str()); }).detach();
+    }
 
-            glm::vec3 cameraX = glm::normalize(glm::cross(cameraDir, camera.up));
-            glm::vec3 cameraY = glm::normalize(glm::cross(cameraX, cameraDir));
-            glm::vec3 rayDirection = glm::normalize(
-                cameraDir + cameraX * screenX + cameraY * screenY
-            );
-           
-            Color pixelColor = castRay(camera.position, rayDirection);
+    std::vector<TileJob> views;
+    Camera view = camera;
+    for (int f = 0; f < options.frames; f++) {
+        TileJob job = {};
+        job.width = options.width;
+        job.height = options.height;
+        for (int k = 0; k < 3; k++) {
+            job.position[k] = view.position[k];
+            job.target[k] = view.target[k];
+            job.up[k] = view.up[k];
+        }
+        views.push_back(job);
+        view.rotate(0.5f, 0.0f);
+    }
 
-            point(glm::vec2(x, y), pixelColor);
+    Uint32 start = SDL_GetTicks();
+    std::vector<std::vector<Color>> frames;
+    coordinator.render(views, frames);
+    SDL_Log("Rendered %d frames in %u ms", options.frames, SDL_GetTicks() - start);
+
+    for (int f = 0; f < options.frames; f++) {
+        char path[512];
+        std::snprintf(path, sizeof(path), "%s_%04d.ppm", options.output.c_str(), f);
+        if (!writePPM(path, frames[f], options.width, options.height)) {
+            SDL_Log("Unable to write %s", path);
+            return 1;
         }
     }
+    return 0;
+}
+
+// Batch flythrough: renders every frame of a camera path and streams it to
+// stdout for an external encoder. Each pool thread renders a whole frame into
+// its own slot; the main thread writes the slots in frame order straight from
+// those buffers and hands each slot back for a later frame. Animated blocks
+// stay where setUp() put them.
+int runBatch(const Options& options) {
+    CameraPath path;
+    try {
+        path = CameraPath::load(options.cameraPath);
+    } catch (const std::exception& e) {
+        SDL_Log("%s", e.what());
+        return 1;
+    }
+
+    ThreadPool assetPool;
+    loadTextures(assetPool);
+    assetPool.wait();
+    setUp();
+
+    VideoFormat format = options.videoFormat == "rgba" ? VideoFormat::RGBA : VideoFormat::Y4M;
+    VideoStream stream(stdout, format, options.width, options.height, options.fps);
+    if (!stream.writeHeader()) {
+        SDL_Log("Unable to write to stdout");
+        return 1;
+    }
+
+    struct Slot {
+        std::vector<Color> pixels;
+        std::vector<uint8_t> planes;
+        int frame = -1;  // frame the buffers hold once rendered
+    };
+
+    ThreadPool pool;
+    int frameCount = static_cast<int>(path.duration() * options.fps) + 1;
+    std::vector<Slot> slots(2 * std::max(1u, std::thread::hardware_concurrency()));
+    std::mutex slotMutex;
+    std::condition_variable slotReady;
+
+    auto renderFrame = [&](int frame) {
+        Slot& slot = slots[frame % slots.size()];
+        Camera view = path.at(static_cast<float>(frame) / options.fps, camera.rotationSpeed);
+        slot.pixels.resize(static_cast<size_t>(options.width) * options.height);
+        for (int y = 0; y < options.height; y++) {
+            traceRow(view, y, 0, options.width, options.width, options.height, &slot.pixels[static_cast<size_t>(y) * options.width]);
+        }
+        if (stream.needsConversion()) {
+            stream.convert(slot.pixels, slot.planes);
+        }
+
+        std::lock_guard<std::mutex> lock(slotMutex);
+        slot.frame = frame;
+        slotReady.notify_all();
+    };
+
+    for (int frame = 0; frame < std::min<int>(frameCount, slots.size()); frame++) {
+        pool.submit([&, frame]() { renderFrame(frame); });
+    }
+
+    Uint32 start = SDL_GetTicks();
+    for (int frame = 0; frame < frameCount; frame++) {
+        Slot& slot = slots[frame % slots.size()];
+        {
+            std::unique_lock<std::mutex> lock(slotMutex);
+            slotReady.wait(lock, [&]() { return slot.frame == frame; });
+        }
+
+        const void* data = stream.needsConversion() ? static_cast<const void*>(slot.planes.data()) : slot.pixels.data();
+        if (!stream.writeFrame(data)) {
+            SDL_Log("Unable to write frame %d, stopping", frame);
+            pool.wait();
+            return 1;
+        }
+
+        int next = frame + static_cast<int>(slots.size());
+        if (next < frameCount) {
+            pool.submit([&, next]() { renderFrame(next); });
+        }
+    }
+    stream.flush();
+    SDL_Log("Streamed %d frames in %u ms", frameCount, SDL_GetTicks() - start);
+    return 0;
+}
+
+// Times full frames of the default scene at --size in every render mode. The
+// pixel cache is cleared before each frame so every pixel is traced; the ray
+// direction table and screen bins are built as in the interactive loop.
+int runBenchmark(const Options& options) {
+    ThreadPool assetPool;
+    loadTextures(assetPool);
+    assetPool.wait();
+    setUp();
+
+    const RenderMode modes[] = {RenderMode::Recursive, RenderMode::Wavefront, RenderMode::Denoised};
+    const char* names[] = {"recursive", "wavefront", "denoised"};
+    for (int m = 0; m < 3; m++) {
+        // One untimed frame to warm the direction table and caches
+        pixelCache.invalidateAll();
+        render(camera, modes[m], options.width, options.height);
+
+        double total = 0.0;
+        double fastest = 1e30;
+        for (int frame = 0; frame < options.benchFrames; frame++) {
+            pixelCache.invalidateAll();
+            Uint64 start = SDL_GetPerformanceCounter();
+            render(camera, modes[m], options.width, options.height);
+            double ms = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+            total += ms;
+            fastest = std::min(fastest, ms);
+        }
+        SDL_Log("%s %dx%d: %.1f ms mean, %.1f ms best over %d frames", names[m], options.width, options.height,
+                total / options.benchFrames, fastest, options.benchFrames);
+    }
+    return 0;
+}
+
+// Edits and animates the default scene step by step and checks, after every
+// step, that the recursive and wavefront tracers agree pixel for pixel, with
+// live and then with baked lighting, and that the lightmaps rebaked from
+// their dirty faces equal a bake from scratch. Returns 1 on any mismatch.
+int runCheck(const Options& options) {
+    ThreadPool assetPool;
+    loadTextures(assetPool);
+    assetPool.wait();
+    setUp();
+
+    auto renderCold = [&](RenderMode mode) {
+        pixelCache.invalidateAll();
+        render(camera, mode, options.width, options.height);
+        return framebuffer;
+    };
+    auto samePixels = [](const std::vector<Color>& a, const std::vector<Color>& b) {
+        return std::memcmp(a.data(), b.data(), a.size() * sizeof(Color)) == 0;
+    };
+
+    int failures = 0;
+    for (bool baked : {false, true}) {
+        useLightmaps = baked;
+        if (baked) {
+            lightmaps.reset(objects.size());
+            updateLightmaps();
+        }
+
+        for (int step = 0; step < 8; step++) {
+            // A view sweeping across the scene alternately places and removes
+            // a block while the animated blocks move on
+            Camera editView(glm::vec3(0.4f * step - 1.5f, 0.5f, 5.0f), glm::vec3(0.3f * step - 1.0f, 0.3f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), camera.rotationSpeed);
+            size_t objectCount = objects.size();
+            if (step % 2 == 0) {
+                placeBlock(editView, step % static_cast<int>(blockPalette.size()));
+            } else {
+                // Aimed at the centre of an existing block so something is
+                // always removed; deletes a derived block through Object*,
+                // which a sanitizer build checks
+                AABB box = objects[(step * 7) % objects.size()]->getBounds();
+                glm::vec3 centre = (box.min + box.max) * 0.5f;
+                removeBlock(Camera(centre + glm::vec3(0.5f, 1.0f, 4.0f), centre, glm::vec3(0.0f, 1.0f, 0.0f), camera.rotationSpeed));
+                if (objects.size() != objectCount - 1) {
+                    SDL_Log("Step %d: no block was removed", step);
+                    failures++;
+                }
+            }
+            animationTime += 0.37f;
+            updateScene(animationTime);
+
+            std::vector<Color> recursive = renderCold(RenderMode::Recursive);
+            std::vector<Color> wavefront = renderCold(RenderMode::Wavefront);
+            if (!samePixels(recursive, wavefront)) {
+                SDL_Log("Step %d%s: recursive and wavefront frames differ", step, baked ? " (baked)" : "");
+                failures++;
+            }
+
+            if (baked) {
+                Lightmaps fresh;
+                fresh.reset(objects.size());
+                updateLightmaps(fresh);
+                if (!lightmaps.sameBake(fresh)) {
+                    SDL_Log("Step %d: incremental lightmaps differ from a fresh bake", step);
+                    failures++;
+                }
+            }
+        }
+    }
+
+    // Disk round trip: a bake saved before the animated blocks moved and
+    // reloaded afterwards must equal a fresh bake, and a truncated file must
+    // be turned down
+    std::string checkPath = temporaryPath(LIGHTMAP_PATH);
+    lightmaps.reset(objects.size());
+    updateLightmaps();
+    if (!saveLightmaps(checkPath)) {
+        failures++;
+    } else {
+        animationTime += 1.3f;
+        updateScene(animationTime);
+        dirtyRegions.clear();
+
+        if (!loadLightmaps(checkPath)) {
+            SDL_Log("Saved lightmaps did not load back");
+            failures++;
+        } else {
+            updateLightmaps();
+            Lightmaps fresh;
+            fresh.reset(objects.size());
+            updateLightmaps(fresh);
+            if (!lightmaps.sameBake(fresh)) {
+                SDL_Log("Reloaded lightmaps differ from a fresh bake");
+                failures++;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::resize_file(checkPath, std::filesystem::file_size(checkPath, error) / 2, error);
+        Lightmaps truncated;
+        std::vector<AABB> unused;
+        if (error || truncated.load(checkPath, Lightmaps::sceneKey(objects, movingObjects(), light.position), unused)) {
+            SDL_Log("A truncated lightmap file was accepted");
+            failures++;
+        }
+        std::filesystem::remove(checkPath, error);
+    }
+
+    SDL_Log(failures ? "Check failed with %d mismatches" : "Check passed", failures);
+    return failures ? 1 : 0;
 }
 
 int main(int argc, char* argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        return 1;
+    }
+    if (!options.worker.empty()) {
+        return runWorker(options);
+    }
+    if (options.coordinator) {
+        return runCoordinator(options, argv[0]);
+    }
+    if (!options.cameraPath.empty()) {
+        return runBatch(options);
+    }
+    if (options.benchFrames > 0) {
+        return runBenchmark(options);
+    }
+    if (options.check) {
+        return runCheck(options);
+    }
 
     // Initialize SDL
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
@@ -268,33 +1179,32 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    ImageLoader::loadImage("grass", "../assets/grama.jpg", 800.0f, 800.0f);
-    ImageLoader::loadImage("obsidian", "../assets/obsidian.jpg", 512.0f, 512.0f);
-    ImageLoader::loadImage("portal", "../assets/portal.jpg", 160.0f, 160.0f);
-    ImageLoader::loadImage("gold", "../assets/gold.jpg", 512.0f, 512.0f);
-    ImageLoader::loadImage("diamond", "../assets/diamond.jpg", 300.0f, 300.0f);
-    ImageLoader::loadImage("netherrack", "../assets/netherrack.jpeg", 400.0f, 400.0f);
-    ImageLoader::loadImage("stone", "../assets/stone.png", 800.0f, 800.0f);
+    // Frames are traced into framebuffer and uploaded to this texture
+    screenTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
 
-    ImageLoader::loadImage("upSky", "../assets/ceil.jpg", 4096.0f, 434.0f);
-    ImageLoader::loadImage("sideSky", "../assets/skybox.jpg", 4096.0f, 2160.0f);
-    ImageLoader::loadImage("floor", "../assets/floor.jpg", 1200.0f, 200.0f);
+    // Textures decode in the background; until each one is ready the scene
+    // renders with its placeholder colour
+    ThreadPool assetPool;
+    loadTextures(assetPool);
 
     bool running = true;
     SDL_Event event;
 
-    int frameCount = 0;
-    Uint32 startTime = SDL_GetTicks();
-    Uint32 currentTime = startTime;
+    Uint32 currentTime = SDL_GetTicks();
     
     setUp();
+    std::thread renderThread(renderLoop);
 
     while (running) {
+        // Wake up for input right away, and often enough to show new frames
+        SDL_WaitEventTimeout(NULL, 2);
+
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_QUIT) {
                 running = false;
             }
 
+            std::lock_guard<std::mutex> lock(inputMutex);
             if (event.type == SDL_KEYDOWN) {
                 switch(event.key.keysym.sym) {
                     case SDLK_UP:
@@ -321,33 +1231,63 @@ int main(int argc, char* argv[]) {
                     case SDLK_d:
                         camera.moveX(1.0f);
                         break;
+                    case SDLK_m:
+                        if (renderMode == RenderMode::Recursive) renderMode = RenderMode::Wavefront;
+                        else if (renderMode == RenderMode::Wavefront) renderMode = RenderMode::Denoised;
+                        else renderMode = RenderMode::Recursive;
+                        break;
+                    case SDLK_r:
+                        dynamicResolution = !dynamicResolution;
+                        break;
+                    case SDLK_p:
+                        animate = !animate;
+                        break;
+                    case SDLK_l:
+                        shadingLevels = !shadingLevels;
+                        break;
+                    case SDLK_b:
+                        bakedLighting = !bakedLighting;
+                        break;
+                    case SDLK_1:
+                    case SDLK_2:
+                    case SDLK_3:
+                    case SDLK_4:
+                    case SDLK_5:
+                        selectedBlock = event.key.keysym.sym - SDLK_1;
+                        break;
                  }
             }
 
-
+            if (event.type == SDL_MOUSEBUTTONDOWN) {
+                if (event.button.button == SDL_BUTTON_LEFT) pendingEdits.push_back(BlockEdit{false, selectedBlock, camera});
+                else if (event.button.button == SDL_BUTTON_RIGHT) pendingEdits.push_back(BlockEdit{true, selectedBlock, camera});
+            }
         }
 
-        // Clear the screen
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-        SDL_RenderClear(renderer);
-
-        render();
-
-        // Present the renderer
-        SDL_RenderPresent(renderer);
-
-        frameCount++;
+        // Show the newest finished frame, if the render thread made one
+        const std::vector<Color>* frame = displayFrames.acquire();
+        if (frame) {
+            present(*frame);
+            SDL_RenderPresent(renderer);
+        }
 
         // Calculate and display FPS
         if (SDL_GetTicks() - currentTime >= 1000) {
             currentTime = SDL_GetTicks();
-            std::string title = "FPS: " + std::to_string(frameCount);
+            std::string title = "FPS: " + std::to_string(framesRendered.exchange(0));
+            int percent = resolutionPercent;
+            if (percent >= 0) {
+                title += " - " + std::to_string(percent) + "% resolution";
+            }
             SDL_SetWindowTitle(window, title.c_str());
-            frameCount = 0;
         }
     }
 
+    rendering = false;
+    renderThread.join();
+
     // Cleanup
+    SDL_DestroyTexture(screenTexture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
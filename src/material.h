@@ -10,4 +10,5 @@ struct Material {
   float reflectivity;
   float transparency;
   float refractionIndex;
+  float roughness = 0.0f;  // glossy spread, only used by the stochastic render mode
 };
\ No newline at end of file
@@ -8,26 +8,26 @@ public:
   Gold(const glm::vec3 &minBound, const glm::vec3 &maxBound, const Material &mat)
       : Cube(minBound, maxBound, mat) {}
 
-  Intersect rayIntersect(const glm::vec3 &rayOrigin, const glm::vec3 &rayDirection) const override
+  Intersect rayIntersect(const glm::vec3 &rayOrigin, const glm::vec3 &rayDirection, float pathDistance) const override
   {
-    Intersect intersect = Cube::rayIntersect(rayOrigin, rayDirection);
+    Intersect intersect = Cube::rayIntersect(rayOrigin, rayDirection, pathDistance);
 
     const float epsilon = 0.0001;
     if (glm::abs(intersect.point.y - maxBound.y) < epsilon)
     {
-      Color c = loadTexture(std::abs(intersect.point.x - minBound.x), std::abs(intersect.point.z - minBound.z), "gold");
+      Color c = loadTexture(std::abs(intersect.point.x - minBound.x), std::abs(intersect.point.z - minBound.z), "gold", intersect.dist + pathDistance);
 
       intersect.color = c;
       intersect.hasColor = true;
     }
     else if (glm::abs(intersect.point.z - maxBound.z) < epsilon || glm::abs(intersect.point.z - minBound.z) < epsilon){
-      Color c = loadTexture(std::abs(intersect.point.x - minBound.x), std::abs(intersect.point.y - minBound.y), "gold");
+      Color c = loadTexture(std::abs(intersect.point.x - minBound.x), std::abs(intersect.point.y - minBound.y), "gold", intersect.dist + pathDistance);
 
       intersect.color = c;
       intersect.hasColor = true;
     }
     else if (glm::abs(intersect.point.x - minBound.x) < epsilon || glm::abs(intersect.point.x - maxBound.x) < epsilon){
-      Color c = loadTexture(std::abs(intersect.point.z - minBound.z), std::abs(intersect.point.y - minBound.y), "gold");
+      Color c = loadTexture(std::abs(intersect.point.z - minBound.z), std::abs(intersect.point.y - minBound.y), "gold", intersect.dist + pathDistance);
 
       intersect.color = c;
       intersect.hasColor = true;
@@ -0,0 +1,176 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET SocketHandle;
+const SocketHandle INVALID_SOCKET_HANDLE = INVALID_SOCKET;
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int SocketHandle;
+const SocketHandle INVALID_SOCKET_HANDLE = -1;
+#endif
+
+// Blocking TCP socket, move-only, closed on destruction.
+class Socket {
+public:
+  Socket() = default;
+  explicit Socket(SocketHandle handle) : handle(handle) {}
+  ~Socket() { close(); }
+
+  Socket(const Socket&) = delete;
+  Socket& operator=(const Socket&) = delete;
+  Socket(Socket&& other) noexcept : handle(other.handle) { other.handle = INVALID_SOCKET_HANDLE; }
+  Socket& operator=(Socket&& other) noexcept {
+    if (this != &other) {
+      close();
+      handle = other.handle;
+      other.handle = INVALID_SOCKET_HANDLE;
+    }
+    return *this;
+  }
+
+  static Socket listenOn(uint16_t port) {
+    startup();
+    Socket socket(::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+    if (!socket.isValid()) return socket;
+
+    int reuse = 1;
+    setsockopt(socket.handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(socket.handle, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(socket.handle, 16) != 0) {
+      socket.close();
+    }
+    return socket;
+  }
+
+  static Socket connectTo(const std::string& host, uint16_t port) {
+    startup();
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* results = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &results) != 0) {
+      return Socket();
+    }
+
+    Socket socket;
+    for (addrinfo* it = results; it; it = it->ai_next) {
+      Socket candidate(::socket(it->ai_family, it->ai_socktype, it->ai_protocol));
+      if (candidate.isValid() && connect(candidate.handle, it->ai_addr, static_cast<int>(it->ai_addrlen)) == 0) {
+        socket = std::move(candidate);
+        break;
+      }
+    }
+    freeaddrinfo(results);
+    socket.setNoDelay();
+    return socket;
+  }
+
+  Socket accept() const {
+    Socket client(::accept(handle, nullptr, nullptr));
+    client.setNoDelay();
+    return client;
+  }
+
+  // True when a read (or accept) would not block within timeoutMs
+  bool waitReadable(int timeoutMs) const {
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(handle, &readable);
+    timeval timeout = {timeoutMs / 1000, (timeoutMs % 1000) * 1000};
+    return select(static_cast<int>(handle) + 1, &readable, nullptr, nullptr, &timeout) > 0;
+  }
+
+  // Reads longer than this fail, which is how a hung peer is detected
+  void setReceiveTimeout(int timeoutMs) {
+#ifdef _WIN32
+    DWORD timeout = timeoutMs;
+#else
+    timeval timeout = {timeoutMs / 1000, (timeoutMs % 1000) * 1000};
+#endif
+    setsockopt(handle, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+  }
+
+  bool sendAll(const void* data, size_t size) const {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+      int chunk = static_cast<int>(size < (1 << 20) ? size : (1 << 20));
+      int sent = send(handle, bytes, chunk, SEND_FLAGS);
+      if (sent <= 0) return false;
+      bytes += sent;
+      size -= sent;
+    }
+    return true;
+  }
+
+  bool recvAll(void* data, size_t size) const {
+    char* bytes = static_cast<char*>(data);
+    while (size > 0) {
+      int chunk = static_cast<int>(size < (1 << 20) ? size : (1 << 20));
+      int received = recv(handle, bytes, chunk, 0);
+      if (received <= 0) return false;
+      bytes += received;
+      size -= received;
+    }
+    return true;
+  }
+
+  bool isValid() const { return handle != INVALID_SOCKET_HANDLE; }
+
+  void close() {
+    if (!isValid()) return;
+#ifdef _WIN32
+    closesocket(handle);
+#else
+    ::close(handle);
+#endif
+    handle = INVALID_SOCKET_HANDLE;
+  }
+
+private:
+  SocketHandle handle = INVALID_SOCKET_HANDLE;
+
+#ifdef MSG_NOSIGNAL
+  static const int SEND_FLAGS = MSG_NOSIGNAL;  // a dead peer must not kill us with SIGPIPE
+#else
+  static const int SEND_FLAGS = 0;
+#endif
+
+  void setNoDelay() {
+    if (!isValid()) return;
+    int on = 1;
+    setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&on), sizeof(on));
+  }
+
+  static void startup() {
+#ifdef _WIN32
+    static bool started = []() {
+      WSADATA data;
+      return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+    (void)started;
+#endif
+  }
+};
@@ -3,11 +3,16 @@
 #include <glm/glm.hpp>
 #include "material.h"
 #include "intersect.h"
+#include "aabb.h"
 
 class Object {
 public:
   Object(const Material& mat) : material(mat) {}
-  virtual Intersect rayIntersect(const glm::vec3& rayOrigin, const glm::vec3& rayDirection) const = 0;
+  virtual ~Object() = default;  // removed blocks are deleted through Object*
+  // pathDistance is how far the ray travelled from the camera before
+  // rayOrigin, so texture level of detail follows the whole path
+  virtual Intersect rayIntersect(const glm::vec3& rayOrigin, const glm::vec3& rayDirection, float pathDistance) const = 0;
+  virtual AABB getBounds() const = 0;
   
   Material material;
-};
\ No newline at end of file
+};
@@ -0,0 +1,33 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Runs body(i) for every i in [begin, end) on all hardware threads. Indices
+// are handed out one at a time, so rows of very different cost still balance.
+template <typename Body>
+void parallelFor(int begin, int end, const Body& body) {
+  int threadCount = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+  threadCount = std::min(threadCount, end - begin);
+  if (threadCount <= 1) {
+    for (int i = begin; i < end; i++) {
+      body(i);
+    }
+    return;
+  }
+
+  std::atomic<int> nextIndex(begin);
+  std::vector<std::thread> threads;
+  threads.reserve(threadCount);
+  for (int t = 0; t < threadCount; t++) {
+    threads.emplace_back([&]() {
+      for (int i = nextIndex++; i < end; i = nextIndex++) {
+        body(i);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "aabb.h"
+#include "camera.h"
+#include "intersect.h"
+#include "parallel.h"
+
+// Remembers where each pixel's primary ray ended, so that after a scene edit
+// only pixels whose camera ray, shadow ray or bounces can reach the edited
+// region are traced again. Everything else keeps last frame's colour.
+class PixelCache {
+public:
+  // Starts a frame. A different view or size drops every cached pixel.
+  void beginFrame(const Camera& view, int w, int h) {
+    bool sameView = w == width && h == height &&
+      view.position == eye && view.target == target && view.up == up;
+    if (!sameView) {
+      width = w;
+      height = h;
+      eye = view.position;
+      target = view.target;
+      up = view.up;
+      size_t count = static_cast<size_t>(w) * h;
+      endX.resize(count); endY.resize(count); endZ.resize(count);
+      flags.resize(count);
+      invalidateAll();
+    }
+  }
+
+  void invalidateAll() {
+    std::fill(flags.begin(), flags.end(), 0);
+  }
+
+  // Drops the pixels whose rays might pass through region. lightPosition is
+  // where shadow rays of cached hits were aimed.
+  void invalidate(const AABB& region, const glm::vec3& lightPosition) {
+    // Padded so rays that graze a face, and hits that start on one, count
+    AABB box{region.min - glm::vec3(PADDING), region.max + glm::vec3(PADDING)};
+
+    parallelFor(0, height, [&](int y) {
+      for (int x = 0; x < width; x++) {
+        int p = y * width + x;
+        uint8_t f = flags[p];
+        if (!(f & VALID)) continue;
+
+        if (f & SECONDARY) {
+          flags[p] = 0;
+          continue;
+        }
+
+        glm::vec3 end(endX[p], endY[p], endZ[p]);
+        bool touched;
+        if (f & HIT) {
+          touched = rayCrosses(box, eye, end - eye, 1.0f) ||
+                    rayCrosses(box, end, lightPosition - end, INFINITE);
+        } else {
+          touched = rayCrosses(box, eye, end, INFINITE);
+        }
+        if (touched) {
+          flags[p] = 0;
+        }
+      }
+    });
+  }
+
+  bool isValid(int pixel) const {
+    return flags[pixel] & VALID;
+  }
+
+  // hit is the primary hit, or nullptr when the ray reached the sky along dir.
+  // Pixels that spawned reflection or refraction rays depend on too much of
+  // the scene to track, so any edit re-traces them.
+  void record(int pixel, const glm::vec3& dir, const Intersect* hit, bool secondary) {
+    glm::vec3 end = hit ? hit->point : dir;
+    endX[pixel] = end.x;
+    endY[pixel] = end.y;
+    endZ[pixel] = end.z;
+    flags[pixel] = VALID | (hit ? HIT : 0) | (secondary ? SECONDARY : 0);
+  }
+
+private:
+  static constexpr uint8_t VALID = 1;
+  static constexpr uint8_t HIT = 2;
+  static constexpr uint8_t SECONDARY = 4;
+  static constexpr float PADDING = 0.001f;
+  static constexpr float INFINITE = 1e30f;
+
+  int width = 0;
+  int height = 0;
+  glm::vec3 eye = glm::vec3(0.0f);
+  glm::vec3 target = glm::vec3(0.0f);
+  glm::vec3 up = glm::vec3(0.0f);
+  std::vector<float> endX, endY, endZ;  // hit point, or the ray direction for sky pixels
+  std::vector<uint8_t> flags;
+};
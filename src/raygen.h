@@ -0,0 +1,99 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cmath>
+#include <vector>
+#include "camera.h"
+#include "parallel.h"
+
+// Primary ray directions. The camera basis and a structure-of-arrays table
+// with one direction per pixel are built once and reused for as long as the
+// view direction, up vector, resolution and field of view stay the same;
+// moving the camera without turning it keeps the table.
+class RayGenerator {
+public:
+  // Returns true when the table had to be rebuilt
+  bool update(const Camera& view, int w, int h, float fov, float aspectRatio) {
+    Basis b = basis(view, fov, aspectRatio);
+    bool unchanged = w == width && h == height && b.forward == current.forward &&
+      b.right == current.right && b.up == current.up && b.aspectRatio == current.aspectRatio && b.tanHalfFov == current.tanHalfFov;
+    if (unchanged) return false;
+
+    current = b;
+    width = w;
+    height = h;
+    size_t count = static_cast<size_t>(w) * h;
+    dirX.resize(count);
+    dirY.resize(count);
+    dirZ.resize(count);
+
+    columnX.resize(w);
+    for (int x = 0; x < w; x++) {
+      columnX[x] = screenX(b, x, w);
+    }
+
+    parallelFor(0, h, [&](int y) {
+      float sy = screenY(b, y, h);
+      size_t row = static_cast<size_t>(y) * w;
+      for (int x = 0; x < w; x++) {
+        glm::vec3 dir = glm::normalize(b.forward + b.right * columnX[x] + b.up * sy);
+        dirX[row + x] = dir.x;
+        dirY[row + x] = dir.y;
+        dirZ[row + x] = dir.z;
+      }
+    });
+    return true;
+  }
+
+  glm::vec3 direction(int pixel) const {
+    return glm::vec3(dirX[pixel], dirY[pixel], dirZ[pixel]);
+  }
+
+  // Row y of the table as three contiguous arrays of width floats
+  const float* rowX(int y) const { return dirX.data() + static_cast<size_t>(y) * width; }
+  const float* rowY(int y) const { return dirY.data() + static_cast<size_t>(y) * width; }
+  const float* rowZ(int y) const { return dirZ.data() + static_cast<size_t>(y) * width; }
+
+  // One ray of an arbitrary view, without touching the table. Gives exactly
+  // the direction the table would hold for that view.
+  static glm::vec3 direction(const Camera& view, int x, int y, int w, int h, float fov, float aspectRatio) {
+    Basis b = basis(view, fov, aspectRatio);
+    return glm::normalize(b.forward + b.right * screenX(b, x, w) + b.up * screenY(b, y, h));
+  }
+
+private:
+  struct Basis {
+    glm::vec3 forward = glm::vec3(0.0f);
+    glm::vec3 right = glm::vec3(0.0f);
+    glm::vec3 up = glm::vec3(0.0f);
+    float aspectRatio = 0.0f;
+    float tanHalfFov = 0.0f;
+  };
+
+  int width = 0;
+  int height = 0;
+  Basis current;
+  std::vector<float> columnX;
+  std::vector<float> dirX, dirY, dirZ;
+
+  static Basis basis(const Camera& view, float fov, float aspectRatio) {
+    Basis b;
+    b.forward = glm::normalize(view.target - view.position);
+    b.right = glm::normalize(glm::cross(b.forward, view.up));
+    b.up = glm::normalize(glm::cross(b.right, b.forward));
+    b.aspectRatio = aspectRatio;
+    b.tanHalfFov = std::tan(fov / 2.0f);
+    return b;
+  }
+
+  static float screenX(const Basis& b, int x, int w) {
+    float sx = (2.0f * (x + 0.5f)) / w - 1.0f;
+    sx *= b.aspectRatio;
+    sx *= b.tanHalfFov;
+    return sx;
+  }
+
+  static float screenY(const Basis& b, int y, int h) {
+    float sy = -(2.0f * (y + 0.5f)) / h + 1.0f;
+    return sy * b.tanHalfFov;
+  }
+};
@@ -0,0 +1,44 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+
+// Picks the internal render scale each frame so that frame time tracks a
+// target. Tracing cost grows with the pixel count, i.e. with scale squared.
+class ResolutionController {
+public:
+  ResolutionController(float targetFrameMs, float minScale, float maxScale)
+    : targetFrameMs(targetFrameMs), minScale(minScale), maxScale(maxScale), scale(maxScale), smoothedMs(targetFrameMs) {}
+
+  void update(float frameMs) {
+    // Smooth out single slow frames (window drags, event bursts)
+    smoothedMs += (frameMs - smoothedMs) * 0.3f;
+
+    float ideal = scale * std::sqrt(targetFrameMs / std::max(smoothedMs, 0.1f));
+    ideal = std::clamp(ideal, minScale, maxScale);
+
+    // Move half way there and ignore tiny corrections so the image does not shimmer
+    if (std::abs(ideal - scale) > 0.02f) {
+      scale += (ideal - scale) * 0.5f;
+    }
+  }
+
+  float getScale() const {
+    return scale;
+  }
+
+  // Internal size for a given window size, kept a multiple of 8 pixels wide
+  int scaledWidth(int width) const {
+    return std::max(8, static_cast<int>(width * scale) / 8 * 8);
+  }
+
+  int scaledHeight(int width, int height) const {
+    return std::max(1, scaledWidth(width) * height / width);
+  }
+
+private:
+  float targetFrameMs;
+  float minScale;
+  float maxScale;
+  float scale;
+  float smoothedMs;
+};
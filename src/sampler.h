@@ -0,0 +1,35 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <cstdint>
+
+// Small PCG-style generator. Seeded per pixel so every thread owns its own
+// sequence and renders are reproducible for a given frame index.
+struct Sampler {
+  uint32_t state;
+
+  Sampler(uint32_t pixel, uint32_t frame) : state(pixel * 9781u + frame * 6271u + 1u) {
+    next();
+  }
+
+  // Uniform float in [0, 1)
+  float next() {
+    state = state * 747796405u + 2891336453u;
+    uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    word = (word >> 22u) ^ word;
+    return (word >> 8) * (1.0f / 16777216.0f);
+  }
+
+  glm::vec3 inUnitSphere() {
+    while (true) {
+      glm::vec3 p(2.0f * next() - 1.0f, 2.0f * next() - 1.0f, 2.0f * next() - 1.0f);
+      if (glm::dot(p, p) <= 1.0f) {
+        return p;
+      }
+    }
+  }
+
+  // Direction jittered inside a cone whose width grows with roughness
+  glm::vec3 perturb(const glm::vec3& dir, float roughness) {
+    return glm::normalize(dir + inUnitSphere() * roughness);
+  }
+};
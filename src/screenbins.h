@@ -0,0 +1,140 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "aabb.h"
+#include "camera.h"
+#include "object.h"
+
+// Objects binned by the screen tiles their boxes cover for one view, so a
+// primary ray only tests the few objects of its tile and a ray in an empty
+// tile is known to see the sky. Candidate lists are in ascending object order,
+// which keeps the lowest-index tie-break of a full scan.
+class ScreenBins {
+public:
+  static const int TILE_SIZE = 16;
+
+  void build(const Camera& view, int w, int h, float fov, float aspectRatio, const std::vector<Object*>& objects) {
+    width = w;
+    tilesX = (w + TILE_SIZE - 1) / TILE_SIZE;
+    tilesY = (h + TILE_SIZE - 1) / TILE_SIZE;
+    int tileCount = tilesX * tilesY;
+
+    glm::vec3 forward = glm::normalize(view.target - view.position);
+    glm::vec3 right = glm::normalize(glm::cross(forward, view.up));
+    glm::vec3 up = glm::normalize(glm::cross(right, forward));
+    float tanHalfFov = std::tan(fov / 2.0f);
+
+    // Tile rectangle of every object, empty when it is off screen
+    rects.resize(objects.size());
+    for (size_t k = 0; k < objects.size(); k++) {
+      rects[k] = project(objects[k]->getBounds(), view.position, forward, right, up, w, h, aspectRatio * tanHalfFov, tanHalfFov);
+    }
+
+    // Counting pass, then fill: one flat index array with per-tile offsets
+    offsets.assign(tileCount + 1, 0);
+    for (const TileRect& r : rects) {
+      for (int ty = r.y0; ty <= r.y1; ty++) {
+        for (int tx = r.x0; tx <= r.x1; tx++) {
+          offsets[ty * tilesX + tx + 1]++;
+        }
+      }
+    }
+    for (int t = 0; t < tileCount; t++) {
+      offsets[t + 1] += offsets[t];
+    }
+    candidates.resize(offsets[tileCount]);
+    std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t k = 0; k < rects.size(); k++) {
+      const TileRect& r = rects[k];
+      for (int ty = r.y0; ty <= r.y1; ty++) {
+        for (int tx = r.x0; tx <= r.x1; tx++) {
+          candidates[fill[ty * tilesX + tx]++] = static_cast<int>(k);
+        }
+      }
+    }
+  }
+
+  int tileCount() const { return tilesX * tilesY; }
+
+  int tileOf(int pixel) const {
+    return (pixel / width / TILE_SIZE) * tilesX + (pixel % width) / TILE_SIZE;
+  }
+
+  bool empty(int tile) const { return offsets[tile] == offsets[tile + 1]; }
+  const int* begin(int tile) const { return candidates.data() + offsets[tile]; }
+  const int* end(int tile) const { return candidates.data() + offsets[tile + 1]; }
+
+  // Same contract as BVH::closest, over the candidates of one tile
+  template <typename Distance>
+  int closest(int tile, float maxDist, const Distance& distance) const {
+    int best = -1;
+    float bestDist = maxDist;
+    for (const int* k = begin(tile); k != end(tile); k++) {
+      float d = distance(*k);
+      if (d >= 0.0f && d < bestDist) {
+        bestDist = d;
+        best = *k;
+      }
+    }
+    return best;
+  }
+
+private:
+  struct TileRect {
+    int x0 = 0, y0 = 0, x1 = -1, y1 = -1;
+  };
+
+  int width = 0;
+  int tilesX = 0;
+  int tilesY = 0;
+  std::vector<TileRect> rects;
+  std::vector<int> offsets;
+  std::vector<int> candidates;
+
+  // Screen rectangle of the box's eight corners, grown by a pixel so rounding
+  // never drops a pixel whose ray grazes an edge. A box reaching behind the eye
+  // plane can cover any pixel and gets the whole screen; one entirely behind it
+  // cannot be seen by a primary ray.
+  TileRect project(const AABB& box, const glm::vec3& eye, const glm::vec3& forward, const glm::vec3& right,
+                   const glm::vec3& up, int w, int h, float scaleX, float scaleY) const {
+    TileRect r;
+    float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f;
+    float farthest = -1e30f;
+    bool nearEye = false;
+    for (int c = 0; c < 8; c++) {
+      glm::vec3 corner((c & 1) ? box.max.x : box.min.x, (c & 2) ? box.max.y : box.min.y, (c & 4) ? box.max.z : box.min.z);
+      glm::vec3 rel = corner - eye;
+      float depth = glm::dot(rel, forward);
+      farthest = std::max(farthest, depth);
+      if (depth <= 1e-4f) {
+        nearEye = true;
+        continue;
+      }
+      float px = (glm::dot(rel, right) / depth / scaleX + 1.0f) * w * 0.5f - 0.5f;
+      float py = (1.0f - glm::dot(rel, up) / depth / scaleY) * h * 0.5f - 0.5f;
+      minX = std::min(minX, px);
+      maxX = std::max(maxX, px);
+      minY = std::min(minY, py);
+      maxY = std::max(maxY, py);
+    }
+    if (farthest < 0.0f) return r;
+    if (nearEye) {
+      minX = minY = -1e30f;
+      maxX = maxY = 1e30f;
+    }
+
+    int x0 = static_cast<int>(std::max(std::floor(minX) - 1.0f, 0.0f));
+    int y0 = static_cast<int>(std::max(std::floor(minY) - 1.0f, 0.0f));
+    int x1 = static_cast<int>(std::min(std::ceil(maxX) + 1.0f, static_cast<float>(w - 1)));
+    int y1 = static_cast<int>(std::min(std::ceil(maxY) + 1.0f, static_cast<float>(h - 1)));
+    if (x0 > x1 || y0 > y1) return r;
+
+    r.x0 = x0 / TILE_SIZE;
+    r.y0 = y0 / TILE_SIZE;
+    r.x1 = x1 / TILE_SIZE;
+    r.y1 = y1 / TILE_SIZE;
+    return r;
+  }
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include "color.h"
+#include "intersect.h"
+#include "material.h"
+#include "light.h"
+
+// Local part of the shading model. castRay and the wavefront tracer both go
+// through these helpers so the two paths produce the same pixels.
+
+inline glm::vec3 reflectDirection(const glm::vec3& rayOrigin, const glm::vec3& normal) {
+  return glm::reflect(-glm::normalize(rayOrigin), normal);
+}
+
+// Shadow intensity given the distance to the first occluder found along the shadow ray
+inline float shadowFromOccluder(float occluderDist, const glm::vec3& shadowOrigin, const Light& light) {
+  float shadowRatio = occluderDist / glm::length(light.position - shadowOrigin);
+  shadowRatio = glm::min(1.0f, shadowRatio);
+  return 1.0f - shadowRatio;
+}
+
+// Diffuse + specular contribution of the light, already weighted by the
+// fraction of energy that is not reflected or refracted. diffuseLightIntensity
+// is the Lambert factor, passed in when it comes from a lightmap.
+inline Color directLight(const Intersect& intersect, const Material& mat, const Light& light, const glm::vec3& rayOrigin, float shadowIntensity, float diffuseLightIntensity) {
+  glm::vec3 viewDir = glm::normalize(rayOrigin - intersect.point);
+  glm::vec3 reflectDir = reflectDirection(rayOrigin, intersect.normal);
+
+  float specLightIntensity = std::pow(std::max(0.0f, glm::dot(viewDir, reflectDir)), mat.specularCoefficient);
+
+  Color materialLight = intersect.hasColor ? intersect.color : mat.diffuse;
+
+  Color diffuseLight = materialLight * light.intensity * diffuseLightIntensity * mat.albedo * shadowIntensity;
+  Color specularLight = light.color * light.intensity * specLightIntensity * mat.specularAlbedo * shadowIntensity;
+  return (diffuseLight + specularLight) * (1.0f - mat.reflectivity - mat.transparency);
+}
+
+inline Color directLight(const Intersect& intersect, const Material& mat, const Light& light, const glm::vec3& rayOrigin, float shadowIntensity) {
+  glm::vec3 lightDir = glm::normalize(light.position - intersect.point);
+  float diffuseLightIntensity = std::max(0.0f, glm::dot(intersect.normal, lightDir));
+  return directLight(intersect, mat, light, rayOrigin, shadowIntensity, diffuseLightIntensity);
+}
+
+inline Color composite(const Color& direct, const Material& mat, const Color& reflectedColor, const Color& refractedColor) {
+  return direct + reflectedColor * mat.reflectivity + refractedColor * mat.transparency;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <algorithm>
+#include "color.h"
+
+// Shading level of detail by hit distance. Past textureStart texels fade into
+// the texture's average colour, past bounceStart a primary hit's reflection
+// and refraction fade into the sky seen along the same directions instead of
+// being traced. Each fade runs over band units so nothing pops as the camera
+// moves.
+struct ShadingLOD {
+  bool enabled = true;
+  float textureStart = 16.0f;
+  float bounceStart = 24.0f;
+  float band = 8.0f;
+
+  // 1 for full detail, 0 for the coarse tier
+  float textureDetail(float dist) const { return detail(dist, textureStart); }
+  float bounceDetail(float dist) const { return detail(dist, bounceStart); }
+
+private:
+  float detail(float dist, float start) const {
+    if (!enabled || dist <= start) return 1.0f;
+    float t = std::min((dist - start) / band, 1.0f);
+    return 1.0f - t * t * (3.0f - 2.0f * t);
+  }
+};
+
+// Shared by the texture lookups in Cube and the shading in castRay and the
+// wavefront tracer. Only changed between frames.
+inline ShadingLOD shadingLOD;
+
+// Cross-fade of a full-detail colour into its coarse stand-in
+inline Color fadeDetail(const Color& full, const Color& coarse, float detail) {
+  if (detail >= 1.0f) return full;
+  if (detail <= 0.0f) return coarse;
+  return full * detail + coarse * (1.0f - detail);
+}
@@ -0,0 +1,215 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "color.h"
+#include "mappedfile.h"
+
+enum class TextureFormat {
+  Surface,  // keep the decoded SDL_Surface as is
+  RGB565,   // 16 bits per texel
+  BC1,      // 4x4 blocks of two RGB565 endpoints + 2 bit indices, 4 bits per texel
+  RGB888    // tightly packed 24 bits per texel, what Surface textures become in the disk cache
+};
+
+// Texture stored in a compact format with a cheap single-texel decode, so sky
+// and block lookups touch 4-8x less memory than the decoded surfaces. The
+// texel data is either owned or borrowed from a memory-mapped cache file.
+class CompressedTexture {
+public:
+  TextureFormat format = TextureFormat::Surface;
+  int width = 0;
+  int height = 0;
+
+  CompressedTexture() = default;
+  CompressedTexture(const CompressedTexture&) = delete;
+  CompressedTexture& operator=(const CompressedTexture&) = delete;
+  CompressedTexture(CompressedTexture&&) = default;
+  CompressedTexture& operator=(CompressedTexture&&) = default;
+
+  static CompressedTexture encode(const std::vector<Color>& pixels, int width, int height, TextureFormat format) {
+    CompressedTexture texture;
+    texture.format = format;
+    texture.width = width;
+    texture.height = height;
+    texture.blocksWide = (width + 3) / 4;
+    texture.storage.resize(payloadSize(format, width, height));
+
+    if (format == TextureFormat::RGB565) {
+      for (size_t i = 0; i < pixels.size(); i++) {
+        uint16_t texel = packRGB565(pixels[i].r, pixels[i].g, pixels[i].b);
+        std::memcpy(&texture.storage[i * sizeof(uint16_t)], &texel, sizeof(texel));
+      }
+    } else if (format == TextureFormat::BC1) {
+      int blocksHigh = (height + 3) / 4;
+      for (int by = 0; by < blocksHigh; by++) {
+        for (int bx = 0; bx < texture.blocksWide; bx++) {
+          uint64_t block = encodeBlock(pixels, width, height, bx * 4, by * 4);
+          std::memcpy(&texture.storage[(by * texture.blocksWide + bx) * sizeof(uint64_t)], &block, sizeof(block));
+        }
+      }
+    } else if (format == TextureFormat::RGB888) {
+      for (size_t i = 0; i < pixels.size(); i++) {
+        texture.storage[i * 3] = pixels[i].r;
+        texture.storage[i * 3 + 1] = pixels[i].g;
+        texture.storage[i * 3 + 2] = pixels[i].b;
+      }
+    } else {
+      throw std::runtime_error("Surface textures are not compressed!");
+    }
+    texture.bytes = texture.storage.data();
+    return texture;
+  }
+
+  // Wraps texel data that lives in a mapped file, without copying it
+  static CompressedTexture fromMapping(std::shared_ptr<MappedFile> file, size_t offset, TextureFormat format, int width, int height) {
+    if (offset + payloadSize(format, width, height) > file->size()) {
+      throw std::runtime_error("Texture cache file is truncated!");
+    }
+    CompressedTexture texture;
+    texture.format = format;
+    texture.width = width;
+    texture.height = height;
+    texture.blocksWide = (width + 3) / 4;
+    texture.bytes = file->data() + offset;
+    texture.mapping = std::move(file);
+    return texture;
+  }
+
+  static size_t payloadSize(TextureFormat format, int width, int height) {
+    switch (format) {
+      case TextureFormat::RGB565: return static_cast<size_t>(width) * height * sizeof(uint16_t);
+      case TextureFormat::BC1: return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * sizeof(uint64_t);
+      case TextureFormat::RGB888: return static_cast<size_t>(width) * height * 3;
+      default: return 0;
+    }
+  }
+
+  const uint8_t* data() const {
+    return bytes;
+  }
+
+  Color fetch(int x, int y) const {
+    if (format == TextureFormat::RGB888) {
+      const uint8_t* p = bytes + (static_cast<size_t>(y) * width + x) * 3;
+      return Color(p[0], p[1], p[2]);
+    }
+
+    if (format == TextureFormat::RGB565) {
+      uint16_t texel;
+      std::memcpy(&texel, bytes + (static_cast<size_t>(y) * width + x) * sizeof(uint16_t), sizeof(texel));
+      return unpackRGB565(texel);
+    }
+
+    uint64_t block;
+    std::memcpy(&block, bytes + static_cast<size_t>((y >> 2) * blocksWide + (x >> 2)) * sizeof(uint64_t), sizeof(block));
+    int shift = 32 + 2 * (((y & 3) << 2) | (x & 3));
+    int index = static_cast<int>((block >> shift) & 3);
+
+    Color c0 = unpackRGB565(static_cast<uint16_t>(block));
+    if (index == 0) return c0;
+    Color c1 = unpackRGB565(static_cast<uint16_t>(block >> 16));
+    if (index == 1) return c1;
+    if (index == 2) return Color((2 * c0.r + c1.r) / 3, (2 * c0.g + c1.g) / 3, (2 * c0.b + c1.b) / 3);
+    return Color((c0.r + 2 * c1.r) / 3, (c0.g + 2 * c1.g) / 3, (c0.b + 2 * c1.b) / 3);
+  }
+
+  size_t byteSize() const {
+    return payloadSize(format, width, height);
+  }
+
+private:
+  int blocksWide = 0;
+  const uint8_t* bytes = nullptr;
+  std::vector<uint8_t> storage;
+  std::shared_ptr<MappedFile> mapping;
+
+  static uint16_t packRGB565(int r, int g, int b) {
+    return static_cast<uint16_t>(((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 | ((b * 31 + 127) / 255));
+  }
+
+  static Color unpackRGB565(uint16_t v) {
+    int r = (v >> 11) & 31;
+    int g = (v >> 5) & 63;
+    int b = v & 31;
+    return Color((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+  }
+
+  // Endpoints are the extremes of the block along its principal colour axis,
+  // each texel then takes the nearest of the four palette entries
+  static uint64_t encodeBlock(const std::vector<Color>& pixels, int width, int height, int x0, int y0) {
+    float block[16][3];
+    float mean[3] = {0.0f, 0.0f, 0.0f};
+    for (int i = 0; i < 16; i++) {
+      int x = std::min(x0 + (i & 3), width - 1);
+      int y = std::min(y0 + (i >> 2), height - 1);
+      const Color& c = pixels[y * width + x];
+      block[i][0] = c.r; block[i][1] = c.g; block[i][2] = c.b;
+      for (int k = 0; k < 3; k++) mean[k] += block[i][k] / 16.0f;
+    }
+
+    float cov[3][3] = {};
+    for (int i = 0; i < 16; i++) {
+      float d[3] = {block[i][0] - mean[0], block[i][1] - mean[1], block[i][2] - mean[2]};
+      for (int a = 0; a < 3; a++)
+        for (int b = 0; b < 3; b++)
+          cov[a][b] += d[a] * d[b];
+    }
+
+    float axis[3] = {1.0f, 1.0f, 1.0f};
+    for (int iteration = 0; iteration < 4; iteration++) {
+      float next[3];
+      for (int a = 0; a < 3; a++) next[a] = cov[a][0] * axis[0] + cov[a][1] * axis[1] + cov[a][2] * axis[2];
+      float len = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+      if (len < 1e-6f) break;
+      for (int a = 0; a < 3; a++) axis[a] = next[a] / len;
+    }
+
+    float minProj = 1e9f, maxProj = -1e9f;
+    for (int i = 0; i < 16; i++) {
+      float p = (block[i][0] - mean[0]) * axis[0] + (block[i][1] - mean[1]) * axis[1] + (block[i][2] - mean[2]) * axis[2];
+      minProj = std::min(minProj, p);
+      maxProj = std::max(maxProj, p);
+    }
+
+    auto endpoint = [&](float t) {
+      int c[3];
+      for (int a = 0; a < 3; a++) c[a] = std::clamp(static_cast<int>(std::lround(mean[a] + axis[a] * t)), 0, 255);
+      return packRGB565(c[0], c[1], c[2]);
+    };
+    uint16_t e0 = endpoint(maxProj);
+    uint16_t e1 = endpoint(minProj);
+    if (e0 < e1) std::swap(e0, e1);
+
+    uint64_t encoded = static_cast<uint64_t>(e0) | static_cast<uint64_t>(e1) << 16;
+    if (e0 == e1) {
+      return encoded;  // flat block, every index 0
+    }
+
+    Color c0 = unpackRGB565(e0), c1 = unpackRGB565(e1);
+    int palette[4][3] = {
+      {c0.r, c0.g, c0.b},
+      {c1.r, c1.g, c1.b},
+      {(2 * c0.r + c1.r) / 3, (2 * c0.g + c1.g) / 3, (2 * c0.b + c1.b) / 3},
+      {(c0.r + 2 * c1.r) / 3, (c0.g + 2 * c1.g) / 3, (c0.b + 2 * c1.b) / 3}
+    };
+    for (int i = 0; i < 16; i++) {
+      int best = 0;
+      float bestDist = 1e9f;
+      for (int p = 0; p < 4; p++) {
+        float dr = block[i][0] - palette[p][0], dg = block[i][1] - palette[p][1], db = block[i][2] - palette[p][2];
+        float dist = dr * dr + dg * dg + db * db;
+        if (dist < bestDist) {
+          bestDist = dist;
+          best = p;
+        }
+      }
+      encoded |= static_cast<uint64_t>(best) << (32 + 2 * i);
+    }
+    return encoded;
+  }
+};
@@ -0,0 +1,81 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads pulling tasks from a FIFO queue. The destructor
+// finishes whatever is queued before joining.
+class ThreadPool {
+public:
+  explicit ThreadPool(unsigned threadCount = std::thread::hardware_concurrency()) {
+    threadCount = std::max(1u, threadCount);
+    for (unsigned i = 0; i < threadCount; i++) {
+      workers.emplace_back([this]() { workerLoop(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    taskReady.notify_all();
+    for (auto& worker : workers) {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  void submit(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push(std::move(task));
+    }
+    taskReady.notify_one();
+  }
+
+  // Blocks until the queue is empty and no task is running
+  void wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    allDone.wait(lock, [this]() { return tasks.empty() && running == 0; });
+  }
+
+private:
+  std::vector<std::thread> workers;
+  std::queue<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable taskReady;
+  std::condition_variable allDone;
+  int running = 0;
+  bool stopping = false;
+
+  void workerLoop() {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        taskReady.wait(lock, [this]() { return stopping || !tasks.empty(); });
+        if (tasks.empty()) return;
+        task = std::move(tasks.front());
+        tasks.pop();
+        running++;
+      }
+
+      task();
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        running--;
+        if (tasks.empty() && running == 0) {
+          allDone.notify_all();
+        }
+      }
+    }
+  }
+};
@@ -0,0 +1,42 @@
+#pragma once
+#include <mutex>
+#include <utility>
+
+// Three buffers passed from one producer thread to one consumer thread. The
+// producer always has a buffer to write into and the consumer always gets the
+// newest finished one, so neither ever waits for the other to be done.
+template <typename T>
+class TripleBuffer {
+public:
+  explicit TripleBuffer(const T& initial = T()) : buffers{initial, initial, initial} {}
+
+  // Producer side: the buffer to fill next
+  T& writeBuffer() {
+    return buffers[writing];
+  }
+
+  // Producer side: makes the filled buffer the newest one
+  void publish() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::swap(writing, ready);
+    fresh = true;
+  }
+
+  // Consumer side: the newest published buffer, or nullptr when nothing was
+  // published since the last call. Stays valid until the next acquire.
+  const T* acquire() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!fresh) return nullptr;
+    std::swap(reading, ready);
+    fresh = false;
+    return &buffers[reading];
+  }
+
+private:
+  T buffers[3];
+  int writing = 0;
+  int ready = 1;
+  int reading = 2;
+  bool fresh = false;
+  std::mutex mutex;
+};
@@ -0,0 +1,58 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+#include "color.h"
+#include "parallel.h"
+
+// Bilinear upscale from the internal render resolution to the window.
+class Upscaler {
+public:
+  static void bilinear(const std::vector<Color>& src, int srcWidth, int srcHeight,
+                       std::vector<Color>& dst, int dstWidth, int dstHeight) {
+    dst.resize(static_cast<size_t>(dstWidth) * dstHeight);
+    if (srcWidth == dstWidth && srcHeight == dstHeight) {
+      std::copy(src.begin(), src.begin() + dst.size(), dst.begin());
+      return;
+    }
+
+    // Horizontal taps are the same for every row
+    std::vector<int> x0(dstWidth), x1(dstWidth);
+    std::vector<int> fx(dstWidth);
+    for (int x = 0; x < dstWidth; x++) {
+      float sx = std::max(0.0f, (x + 0.5f) * srcWidth / dstWidth - 0.5f);
+      x0[x] = std::min(static_cast<int>(sx), srcWidth - 1);
+      x1[x] = std::min(x0[x] + 1, srcWidth - 1);
+      fx[x] = static_cast<int>((sx - x0[x]) * 256.0f);
+    }
+
+    parallelFor(0, dstHeight, [&](int y) {
+      float sy = std::max(0.0f, (y + 0.5f) * srcHeight / dstHeight - 0.5f);
+      int y0 = std::min(static_cast<int>(sy), srcHeight - 1);
+      int y1 = std::min(y0 + 1, srcHeight - 1);
+      int fy = static_cast<int>((sy - y0) * 256.0f);
+
+      const Color* row0 = &src[static_cast<size_t>(y0) * srcWidth];
+      const Color* row1 = &src[static_cast<size_t>(y1) * srcWidth];
+      Color* out = &dst[static_cast<size_t>(y) * dstWidth];
+
+      for (int x = 0; x < dstWidth; x++) {
+        const Color& a = row0[x0[x]];
+        const Color& b = row0[x1[x]];
+        const Color& c = row1[x0[x]];
+        const Color& d = row1[x1[x]];
+        out[x].r = lerp2(a.r, b.r, c.r, d.r, fx[x], fy);
+        out[x].g = lerp2(a.g, b.g, c.g, d.g, fx[x], fy);
+        out[x].b = lerp2(a.b, b.b, c.b, d.b, fx[x], fy);
+        out[x].a = 255;
+      }
+    });
+  }
+
+private:
+  // Fixed point bilinear blend with 8 bit weights
+  static Uint8 lerp2(int a, int b, int c, int d, int fx, int fy) {
+    int top = a * (256 - fx) + b * fx;
+    int bottom = c * (256 - fx) + d * fx;
+    return static_cast<Uint8>((top * (256 - fy) + bottom * fy) >> 16);
+  }
+};
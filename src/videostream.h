@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "color.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+enum class VideoFormat {
+  Y4M,   // YUV4MPEG2, 4:4:4 planar, understood by ffmpeg and most encoders as is
+  RGBA   // headerless rawvideo, 4 bytes per pixel exactly as rendered
+};
+
+// Uncompressed frame stream for an external encoder, e.g.
+//   minecraft --path flythrough.txt | ffmpeg -i - out.mp4
+//   minecraft --path flythrough.txt --format rgba | ffmpeg -f rawvideo -pix_fmt rgba -s 800x600 -i - out.mp4
+// Frames are written straight from the caller's buffers.
+class VideoStream {
+public:
+  VideoStream(FILE* out, VideoFormat format, int width, int height, int fps)
+    : out(out), format(format), width(width), height(height), fps(fps) {
+#ifdef _WIN32
+    // Text mode would turn every 0x0A byte into 0x0D 0x0A
+    _setmode(_fileno(out), _O_BINARY);
+#endif
+  }
+
+  bool writeHeader() {
+    if (format != VideoFormat::Y4M) return true;
+    std::string header = "YUV4MPEG2 W" + std::to_string(width) + " H" + std::to_string(height) +
+                         " F" + std::to_string(fps) + ":1 Ip A1:1 C444\n";
+    return std::fwrite(header.data(), 1, header.size(), out) == header.size();
+  }
+
+  // Y4M frames are planar YUV, so the rendered pixels go through convert
+  // first; RGBA frames are written from the pixels directly
+  bool needsConversion() const {
+    return format == VideoFormat::Y4M;
+  }
+
+  // BT.601 studio-range RGB to YUV 4:4:4 planes, safe to call from any thread
+  void convert(const std::vector<Color>& pixels, std::vector<uint8_t>& planes) const {
+    size_t count = static_cast<size_t>(width) * height;
+    planes.resize(count * 3);
+    uint8_t* y = planes.data();
+    uint8_t* u = y + count;
+    uint8_t* v = u + count;
+    for (size_t i = 0; i < count; i++) {
+      int r = pixels[i].r, g = pixels[i].g, b = pixels[i].b;
+      y[i] = static_cast<uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+      u[i] = static_cast<uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+      v[i] = static_cast<uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+    }
+  }
+
+  // frame is the converted planes for Y4M or the rendered pixels for RGBA
+  bool writeFrame(const void* frame) {
+    size_t bytes = static_cast<size_t>(width) * height * (format == VideoFormat::Y4M ? 3 : sizeof(Color));
+    if (format == VideoFormat::Y4M && std::fwrite("FRAME\n", 1, 6, out) != 6) {
+      return false;
+    }
+    return std::fwrite(frame, 1, bytes, out) == bytes;
+  }
+
+  bool flush() {
+    return std::fflush(out) == 0;
+  }
+
+private:
+  FILE* out;
+  VideoFormat format;
+  int width;
+  int height;
+  int fps;
+};
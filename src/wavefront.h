@@ -0,0 +1,487 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "bvh.h"
+#include "color.h"
+#include "intersect.h"
+#include "object.h"
+#include "light.h"
+#include "skybox.h"
+#include "shading.h"
+#include "screenbins.h"
+#include "shadinglod.h"
+#include "lightmap.h"
+
+const uint8_t RAY_PRIMARY = 0;
+const uint8_t RAY_REFLECTED = 1;
+const uint8_t RAY_REFRACTED = 2;
+
+// One bounce generation of rays, stored as structure-of-arrays so the
+// intersection and shadow loops run over contiguous floats.
+struct RayQueue {
+  std::vector<float> originX, originY, originZ;
+  std::vector<float> dirX, dirY, dirZ;
+  std::vector<int> parent;    // ray index in the previous generation, pixel index for primary rays
+  std::vector<uint8_t> kind;
+  std::vector<int> exclude;   // object the ray was spawned from, -1 for none
+  std::vector<float> pathDist;  // distance from the camera to the origin along the ray path
+
+  // Filled in by the stages
+  std::vector<int> hitObject;
+  std::vector<float> hitDist;
+  std::vector<Intersect> hits;
+  std::vector<Color> direct;
+  std::vector<Color> reflected;
+  std::vector<Color> refracted;
+  std::vector<Color> result;
+  std::vector<float> detail;  // bounce detail of each hit, see ShadingLOD
+
+  size_t size() const { return parent.size(); }
+
+  void clear() {
+    originX.clear(); originY.clear(); originZ.clear();
+    dirX.clear(); dirY.clear(); dirZ.clear();
+    parent.clear(); kind.clear(); exclude.clear(); pathDist.clear();
+    hitObject.clear(); hitDist.clear(); hits.clear();
+    direct.clear(); reflected.clear(); refracted.clear(); result.clear(); detail.clear();
+  }
+
+  void push(const glm::vec3& origin, const glm::vec3& dir, int parentIndex, uint8_t rayKind, int excludeObject, float pathDistance) {
+    originX.push_back(origin.x); originY.push_back(origin.y); originZ.push_back(origin.z);
+    dirX.push_back(dir.x); dirY.push_back(dir.y); dirZ.push_back(dir.z);
+    parent.push_back(parentIndex);
+    kind.push_back(rayKind);
+    exclude.push_back(excludeObject);
+    pathDist.push_back(pathDistance);
+  }
+
+  // Rays sharing one origin, with directions taken from contiguous arrays
+  void pushBatch(const glm::vec3& origin, const float* dx, const float* dy, const float* dz, int firstParent, int count, uint8_t rayKind) {
+    originX.insert(originX.end(), count, origin.x);
+    originY.insert(originY.end(), count, origin.y);
+    originZ.insert(originZ.end(), count, origin.z);
+    dirX.insert(dirX.end(), dx, dx + count);
+    dirY.insert(dirY.end(), dy, dy + count);
+    dirZ.insert(dirZ.end(), dz, dz + count);
+    for (int i = 0; i < count; i++) {
+      parent.push_back(firstParent + i);
+    }
+    kind.insert(kind.end(), count, rayKind);
+    exclude.insert(exclude.end(), count, -1);
+    pathDist.insert(pathDist.end(), count, 0.0f);
+  }
+
+  glm::vec3 origin(size_t i) const { return glm::vec3(originX[i], originY[i], originZ[i]); }
+  glm::vec3 direction(size_t i) const { return glm::vec3(dirX[i], dirY[i], dirZ[i]); }
+
+  // Permute every populated per-ray array so that ray order[i] becomes ray i
+  void reorder(const std::vector<int>& order) {
+    gather(originX, order); gather(originY, order); gather(originZ, order);
+    gather(dirX, order); gather(dirY, order); gather(dirZ, order);
+    gather(parent, order); gather(kind, order); gather(exclude, order); gather(pathDist, order);
+    gather(hitObject, order); gather(hitDist, order); gather(hits, order);
+  }
+
+private:
+  template <typename T>
+  static void gather(std::vector<T>& values, const std::vector<int>& order) {
+    if (values.empty()) return;
+    std::vector<T> sorted(values.size());
+    for (size_t i = 0; i < order.size(); i++) {
+      sorted[i] = values[order[i]];
+    }
+    values.swap(sorted);
+  }
+};
+
+// Breadth-first tracer: every generation of rays goes through intersect,
+// shadow, shade and spawn as whole batches, and the recursion of castRay is
+// resolved bottom-up at the end. Matches castRay pixel for pixel.
+class WavefrontTracer {
+public:
+  WavefrontTracer(int maxRecursion, float bias)
+    : maxRecursion(maxRecursion), bias(bias), generations(maxRecursion + 1) {}
+
+  void beginFrame() {
+    for (auto& queue : generations) {
+      queue.clear();
+    }
+  }
+
+  void addPrimaryRay(const glm::vec3& origin, const glm::vec3& dir, int pixel) {
+    generations[0].push(origin, dir, pixel, RAY_PRIMARY, -1, 0.0f);
+  }
+
+  // count primary rays for consecutive pixels starting at firstPixel
+  void addPrimaryRays(const glm::vec3& origin, const float* dx, const float* dy, const float* dz, int firstPixel, int count) {
+    generations[0].pushBatch(origin, dx, dy, dz, firstPixel, count, RAY_PRIMARY);
+  }
+
+  // With screen bins for the frame, primary rays are grouped by tile and only
+  // tested against that tile's objects. With lightmaps, hits on baked faces
+  // take their shadow and Lambert term from there instead of a shadow ray.
+  // With the scene's BVH, secondary and shadow rays traverse it instead of
+  // testing every object.
+  void trace(const std::vector<Object*>& objects, const Light& light, std::vector<Color>& framebuffer,
+             const ScreenBins* bins = nullptr, const Lightmaps* lightmaps = nullptr, const BVH* bvh = nullptr) {
+    bounds.resize(objects.size());
+    for (size_t k = 0; k < objects.size(); k++) {
+      bounds[k] = objects[k]->getBounds();
+    }
+
+    for (int generation = 0; generation <= maxRecursion; generation++) {
+      RayQueue& queue = generations[generation];
+      if (queue.size() == 0) break;
+
+      if (generation == maxRecursion) {
+        // castRay returns the skybox at the recursion limit, hit or not
+        queue.hitObject.assign(queue.size(), -1);
+      } else if (generation == 0 && bins) {
+        queue.reorder(binOrder(tileKeys(queue, *bins), bins->tileCount()));
+        intersectTiles(queue, objects, *bins);
+        queue.reorder(binOrder(materialKeys(queue), static_cast<int>(objects.size()) + 1));
+      } else {
+        queue.reorder(binOrder(directionKeys(queue), 24));
+        intersectStage(queue, objects, bvh);
+        queue.reorder(binOrder(materialKeys(queue), static_cast<int>(objects.size()) + 1));
+      }
+
+      skyStage(queue);
+      if (generation == maxRecursion) break;
+
+      shadowStage(queue, light, lightmaps, bvh);
+      shadeStage(queue, objects, light);
+      spawnStage(queue, objects, generations[generation + 1]);
+    }
+
+    resolve(objects, framebuffer);
+  }
+
+  // Primary rays of the last trace and what they hit, in traced order
+  const RayQueue& primaryRays() const {
+    return generations[0];
+  }
+
+private:
+  int maxRecursion;
+  float bias;
+  std::vector<RayQueue> generations;
+  std::vector<AABB> bounds;
+
+  // Scratch arrays reused across stages and frames
+  std::vector<float> invX, invY, invZ;
+  std::vector<int> hitRays;
+  std::vector<int> liveRays;
+  std::vector<uint8_t> baked;
+  std::vector<float> bakedDiffuse;
+  std::vector<float> shadow;
+  std::vector<int> occluder;
+  std::vector<float> occluderDist;
+  std::vector<float> shadowOriginX, shadowOriginY, shadowOriginZ;
+
+  // Stable counting sort, returns the permutation that groups rays by key
+  static std::vector<int> binOrder(const std::vector<int>& keys, int bins) {
+    std::vector<int> offsets(bins + 1, 0);
+    for (int key : keys) {
+      offsets[key + 1]++;
+    }
+    for (int b = 0; b < bins; b++) {
+      offsets[b + 1] += offsets[b];
+    }
+    std::vector<int> order(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+      order[offsets[keys[i]]++] = static_cast<int>(i);
+    }
+    return order;
+  }
+
+  // Octant of the direction and its dominant axis: rays in a bin traverse the
+  // scene in the same order and touch the same boxes
+  static std::vector<int> directionKeys(const RayQueue& queue) {
+    std::vector<int> keys(queue.size());
+    for (size_t i = 0; i < queue.size(); i++) {
+      float x = queue.dirX[i], y = queue.dirY[i], z = queue.dirZ[i];
+      int octant = (x < 0.0f) | ((y < 0.0f) << 1) | ((z < 0.0f) << 2);
+      float ax = std::abs(x), ay = std::abs(y), az = std::abs(z);
+      int axis = (ax >= ay && ax >= az) ? 0 : (ay >= az ? 1 : 2);
+      keys[i] = octant * 3 + axis;
+    }
+    return keys;
+  }
+
+  // Screen tile of each primary ray's pixel
+  static std::vector<int> tileKeys(const RayQueue& queue, const ScreenBins& bins) {
+    std::vector<int> keys(queue.size());
+    for (size_t i = 0; i < queue.size(); i++) {
+      keys[i] = bins.tileOf(queue.parent[i]);
+    }
+    return keys;
+  }
+
+  // Misses first, then hits grouped by object so shading walks one material
+  // and one texture at a time
+  static std::vector<int> materialKeys(const RayQueue& queue) {
+    std::vector<int> keys(queue.size());
+    for (size_t i = 0; i < queue.size(); i++) {
+      keys[i] = queue.hitObject[i] + 1;
+    }
+    return keys;
+  }
+
+  void computeInverse(const float* dx, const float* dy, const float* dz, size_t n) {
+    invX.resize(n); invY.resize(n); invZ.resize(n);
+    for (size_t i = 0; i < n; i++) {
+      invX[i] = 1.0f / dx[i];
+      invY[i] = 1.0f / dy[i];
+      invZ[i] = 1.0f / dz[i];
+    }
+  }
+
+  // Same slab test as Cube::rayIntersect, one box against a batch of rays.
+  // Writes the entry distance into dist, or -1 when the ray misses.
+  static void slabTest(const AABB& box, const float* ox, const float* oy, const float* oz,
+                       const float* ix, const float* iy, const float* iz, float* dist, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      float t1x = (box.min.x - ox[i]) * ix[i];
+      float t1y = (box.min.y - oy[i]) * iy[i];
+      float t1z = (box.min.z - oz[i]) * iz[i];
+      float t2x = (box.max.x - ox[i]) * ix[i];
+      float t2y = (box.max.y - oy[i]) * iy[i];
+      float t2z = (box.max.z - oz[i]) * iz[i];
+
+      float tNear = std::max(std::max(std::min(t1x, t2x), std::min(t1y, t2y)), std::min(t1z, t2z));
+      float tFar = std::min(std::min(std::max(t1x, t2x), std::max(t1y, t2y)), std::max(t1z, t2z));
+
+      bool miss = tNear > tFar || tFar < 0;
+      float d = (tNear < 0) ? tFar : tNear;
+      dist[i] = miss ? -1.0f : d;
+    }
+  }
+
+  void intersectStage(RayQueue& queue, const std::vector<Object*>& objects, const BVH* bvh) {
+    size_t n = queue.size();
+    queue.hitObject.assign(n, -1);
+    queue.hitDist.assign(n, 99999.0f);
+    computeInverse(queue.dirX.data(), queue.dirY.data(), queue.dirZ.data(), n);
+
+    if (bvh) {
+      // Nearest box along each ray, with the same slab arithmetic and the
+      // same lowest-index tie-break as the loop over every object below
+      for (size_t i = 0; i < n; i++) {
+        queue.hitObject[i] = bvh->closest(queue.origin(i), queue.direction(i), 99999.0f, [&](int k) {
+          if (k == queue.exclude[i]) return -1.0f;
+          float d;
+          slabTest(bounds[k], &queue.originX[i], &queue.originY[i], &queue.originZ[i], &invX[i], &invY[i], &invZ[i], &d, 1);
+          return d;
+        });
+        if (queue.hitObject[i] >= 0) {
+          float d;
+          slabTest(bounds[queue.hitObject[i]], &queue.originX[i], &queue.originY[i], &queue.originZ[i], &invX[i], &invY[i], &invZ[i], &d, 1);
+          queue.hitDist[i] = d;
+        }
+      }
+      resolveHits(queue, objects);
+      return;
+    }
+
+    std::vector<float> dist(n);
+    for (size_t k = 0; k < bounds.size(); k++) {
+      intersectRange(queue, static_cast<int>(k), 0, n, dist.data());
+    }
+    resolveHits(queue, objects);
+  }
+
+  // Primary rays sorted by tile: each run of rays in one tile goes through the
+  // slab test against that tile's candidates only, and runs in empty tiles
+  // are left as misses for the sky stage
+  void intersectTiles(RayQueue& queue, const std::vector<Object*>& objects, const ScreenBins& bins) {
+    size_t n = queue.size();
+    queue.hitObject.assign(n, -1);
+    queue.hitDist.assign(n, 99999.0f);
+    computeInverse(queue.dirX.data(), queue.dirY.data(), queue.dirZ.data(), n);
+
+    std::vector<float> dist(n);
+    size_t start = 0;
+    while (start < n) {
+      int tile = bins.tileOf(queue.parent[start]);
+      size_t end = start + 1;
+      while (end < n && bins.tileOf(queue.parent[end]) == tile) {
+        end++;
+      }
+      for (const int* k = bins.begin(tile); k != bins.end(tile); k++) {
+        intersectRange(queue, *k, start, end, dist.data());
+      }
+      start = end;
+    }
+    resolveHits(queue, objects);
+  }
+
+  // Slab test of one object against rays [start, end), keeping the nearest hit
+  void intersectRange(RayQueue& queue, int object, size_t start, size_t end, float* dist) {
+    size_t count = end - start;
+    slabTest(bounds[object], queue.originX.data() + start, queue.originY.data() + start, queue.originZ.data() + start,
+             invX.data() + start, invY.data() + start, invZ.data() + start, dist + start, count);
+    for (size_t i = start; i < end; i++) {
+      bool closer = dist[i] >= 0.0f && dist[i] < queue.hitDist[i] && queue.exclude[i] != object;
+      queue.hitDist[i] = closer ? dist[i] : queue.hitDist[i];
+      queue.hitObject[i] = closer ? object : queue.hitObject[i];
+    }
+  }
+
+  // Only the winning object computes normal and texture colour
+  void resolveHits(RayQueue& queue, const std::vector<Object*>& objects) {
+    size_t n = queue.size();
+    queue.hits.resize(n);
+    for (size_t i = 0; i < n; i++) {
+      if (queue.hitObject[i] >= 0) {
+        queue.hits[i] = objects[queue.hitObject[i]]->rayIntersect(queue.origin(i), queue.direction(i), queue.pathDist[i]);
+      } else {
+        queue.hits[i] = Intersect{false};
+      }
+    }
+  }
+
+  void skyStage(RayQueue& queue) {
+    queue.result.resize(queue.size());
+    for (size_t i = 0; i < queue.size(); i++) {
+      if (queue.hitObject[i] < 0) {
+        queue.result[i] = Skybox::getColor(queue.origin(i), queue.direction(i));
+      }
+    }
+  }
+
+  // First occluder in scene order, like castShadow, for the hits that have
+  // no lightmap texel to read it from
+  void shadowStage(RayQueue& queue, const Light& light, const Lightmaps* lightmaps, const BVH* bvh) {
+    hitRays.clear();
+    for (size_t i = 0; i < queue.size(); i++) {
+      if (queue.hitObject[i] >= 0) {
+        hitRays.push_back(static_cast<int>(i));
+      }
+    }
+
+    size_t n = hitRays.size();
+    baked.assign(n, 0);
+    bakedDiffuse.resize(n);
+    shadow.resize(n);
+    liveRays.clear();
+    for (size_t j = 0; j < n; j++) {
+      int i = hitRays[j];
+      baked[j] = lightmaps && lightmaps->sample(queue.hitObject[i], queue.hits[i], bakedDiffuse[j], shadow[j]);
+      if (!baked[j]) {
+        liveRays.push_back(static_cast<int>(j));
+      }
+    }
+
+    size_t m = liveRays.size();
+    shadowOriginX.resize(m); shadowOriginY.resize(m); shadowOriginZ.resize(m);
+    std::vector<float> lightX(m), lightY(m), lightZ(m);
+    for (size_t l = 0; l < m; l++) {
+      const Intersect& hit = queue.hits[hitRays[liveRays[l]]];
+      glm::vec3 lightDir = glm::normalize(light.position - hit.point);
+      shadowOriginX[l] = hit.point.x; shadowOriginY[l] = hit.point.y; shadowOriginZ[l] = hit.point.z;
+      lightX[l] = lightDir.x; lightY[l] = lightDir.y; lightZ[l] = lightDir.z;
+    }
+    computeInverse(lightX.data(), lightY.data(), lightZ.data(), m);
+
+    occluder.assign(m, -1);
+    occluderDist.assign(m, 0.0f);
+    if (bvh) {
+      // BVH::first only accepts indices below the current occluder, so the
+      // last accepted distance belongs to the lowest-index occluder
+      for (size_t l = 0; l < m; l++) {
+        int hitObject = queue.hitObject[hitRays[liveRays[l]]];
+        glm::vec3 origin(shadowOriginX[l], shadowOriginY[l], shadowOriginZ[l]);
+        occluder[l] = bvh->first(origin, glm::vec3(lightX[l], lightY[l], lightZ[l]), [&](int k) {
+          if (k == hitObject) return false;
+          float d;
+          slabTest(bounds[k], &shadowOriginX[l], &shadowOriginY[l], &shadowOriginZ[l], &invX[l], &invY[l], &invZ[l], &d, 1);
+          if (d <= 0.0f) return false;
+          occluderDist[l] = d;
+          return true;
+        });
+      }
+    }
+
+    std::vector<float> dist(bvh ? 0 : m);
+    for (size_t k = 0; !bvh && k < bounds.size(); k++) {
+      slabTest(bounds[k], shadowOriginX.data(), shadowOriginY.data(), shadowOriginZ.data(),
+               invX.data(), invY.data(), invZ.data(), dist.data(), m);
+      int object = static_cast<int>(k);
+      for (size_t l = 0; l < m; l++) {
+        bool first = occluder[l] < 0 && dist[l] > 0.0f && queue.hitObject[hitRays[liveRays[l]]] != object;
+        occluderDist[l] = first ? dist[l] : occluderDist[l];
+        occluder[l] = first ? object : occluder[l];
+      }
+    }
+
+    for (size_t l = 0; l < m; l++) {
+      const Intersect& hit = queue.hits[hitRays[liveRays[l]]];
+      shadow[liveRays[l]] = occluder[l] < 0 ? 1.0f : shadowFromOccluder(occluderDist[l], hit.point, light);
+    }
+  }
+
+  void shadeStage(RayQueue& queue, const std::vector<Object*>& objects, const Light& light) {
+    queue.direct.resize(queue.size());
+    for (size_t j = 0; j < hitRays.size(); j++) {
+      int i = hitRays[j];
+      const Intersect& hit = queue.hits[i];
+      const Material& mat = objects[queue.hitObject[i]]->material;
+      queue.direct[i] = baked[j] ? directLight(hit, mat, light, queue.origin(i), shadow[j], bakedDiffuse[j])
+                                 : directLight(hit, mat, light, queue.origin(i), shadow[j]);
+    }
+  }
+
+  void spawnStage(RayQueue& queue, const std::vector<Object*>& objects, RayQueue& next) {
+    queue.reflected.assign(queue.size(), Color(0.0f, 0.0f, 0.0f));
+    queue.refracted.assign(queue.size(), Color(0.0f, 0.0f, 0.0f));
+    queue.detail.assign(queue.size(), 1.0f);
+    for (int i : hitRays) {
+      const Intersect& hit = queue.hits[i];
+      const Material& mat = objects[queue.hitObject[i]]->material;
+
+      // Like shadeHit: far primary hits start from the sky along each bounce
+      // and only spawn the ray while it still contributes
+      float detail = queue.kind[i] == RAY_PRIMARY ? shadingLOD.bounceDetail(hit.dist) : 1.0f;
+      queue.detail[i] = detail;
+      float childPath = queue.pathDist[i] + hit.dist;
+
+      if (mat.reflectivity > 0) {
+        glm::vec3 origin = hit.point + hit.normal * bias;
+        glm::vec3 reflectDir = reflectDirection(queue.origin(i), hit.normal);
+        if (detail < 1.0f) queue.reflected[i] = Skybox::getColor(origin, reflectDir);
+        if (detail > 0.0f) next.push(origin, reflectDir, i, RAY_REFLECTED, queue.hitObject[i], childPath);
+      }
+      if (mat.transparency > 0) {
+        glm::vec3 origin = hit.point - hit.normal * bias;
+        glm::vec3 refractDir = glm::refract(queue.direction(i), hit.normal, mat.refractionIndex);
+        if (detail < 1.0f) queue.refracted[i] = Skybox::getColor(origin, refractDir);
+        if (detail > 0.0f) next.push(origin, refractDir, i, RAY_REFRACTED, queue.hitObject[i], childPath);
+      }
+    }
+  }
+
+  // Walk the generations deepest first, compositing each hit with the colours
+  // its children returned
+  void resolve(const std::vector<Object*>& objects, std::vector<Color>& framebuffer) {
+    for (int generation = maxRecursion; generation >= 0; generation--) {
+      RayQueue& queue = generations[generation];
+      for (size_t i = 0; i < queue.size(); i++) {
+        if (queue.hitObject[i] >= 0) {
+          const Material& mat = objects[queue.hitObject[i]]->material;
+          queue.result[i] = composite(queue.direct[i], mat, queue.reflected[i], queue.refracted[i]);
+        }
+
+        if (generation == 0) {
+          framebuffer[queue.parent[i]] = queue.result[i];
+          continue;
+        }
+        RayQueue& parent = generations[generation - 1];
+        Color& slot = queue.kind[i] == RAY_REFLECTED ? parent.reflected[queue.parent[i]] : parent.refracted[queue.parent[i]];
+        slot = fadeDetail(queue.result[i], slot, parent.detail[queue.parent[i]]);
+      }
+    }
+  }
+};